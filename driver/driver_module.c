@@ -13,6 +13,9 @@
 
 #include "revision.h"
 #include "px4_usb.h"
+#ifdef ITEDTV_BUS_USE_EMU
+#include "emu_device.h"
+#endif
 #include "firmware.h"
 
 int init_module(void)
@@ -44,11 +47,22 @@ int init_module(void)
 	if (ret)
 		return ret;
 
+#ifdef ITEDTV_BUS_USE_EMU
+	ret = emu_device_register();
+	if (ret) {
+		px4_usb_unregister();
+		return ret;
+	}
+#endif
+
 	return 0;
 }
 
 void cleanup_module(void)
 {
+#ifdef ITEDTV_BUS_USE_EMU
+	emu_device_unregister();
+#endif
 	px4_usb_unregister();
 }
 
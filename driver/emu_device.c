@@ -0,0 +1,468 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PTX driver for the emulated device (emu_device.c)
+ *
+ * Exposes the character devices of an IT930x based receiver without any
+ * hardware. The stream is replayed from a TS capture file by the emulated
+ * bus (itedtv_bus_emu.c) and goes through the same demux and ring buffer
+ * as the stream from the USB devices.
+ */
+
+#include "print_format.h"
+#include "emu_device.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+
+#include "px4_device_params.h"
+#include "ts_demux.h"
+
+struct emu_stream_context {
+	struct ptx_chrdev *chrdev[EMU_CHRDEV_MAX_NUM];
+	int num;
+	struct ts_demux demux;
+};
+
+static unsigned int emu_tuners = 0;
+static char *emu_capture = NULL;
+static unsigned int emu_bitrate = 32000000;
+static unsigned int emu_chunk_packets = 816;
+static bool emu_tagged = false;
+
+module_param(emu_tuners, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(emu_tuners,
+		 "Number of tuners of the emulated device, " \
+		 "0 to disable the emulator. (default: 0)");
+
+module_param(emu_capture, charp, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(emu_capture,
+		 "Path of the TS capture file replayed by the emulated device.");
+
+module_param(emu_bitrate, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(emu_bitrate,
+		 "Replay rate in bits per second, 0 for unlimited. " \
+		 "(default: 32000000)");
+
+module_param(emu_chunk_packets, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(emu_chunk_packets,
+		 "Number of TS packets passed to the stream handler at once. " \
+		 "(default: 816)");
+
+module_param(emu_tagged, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(emu_tagged,
+		 "The capture carries the stream id in the sync byte " \
+		 "as the IT930x bridge outputs it. (default: N)");
+
+static struct ptx_chrdev_context *emu_chrdev_ctx = NULL;
+static struct device *emu_root_dev = NULL;
+static struct emu_device *emu_dev = NULL;
+static struct completion emu_quit_completion;
+
+static void emu_device_release(struct kref *kref);
+
+static void emu_device_stream_put(void *context, int id, u8 *buf, u32 len)
+{
+	struct emu_stream_context *stream_ctx = context;
+
+	ptx_chrdev_put_stream(stream_ctx->chrdev[id], buf, len);
+}
+
+static int emu_device_stream_handler(void *context, void *buf, u32 len)
+{
+	struct emu_stream_context *stream_ctx = context;
+	int i;
+
+	for (i = 0; i < stream_ctx->num; i++)
+		ptx_chrdev_put_stream_begin(stream_ctx->chrdev[i]);
+
+	ts_demux_process(&stream_ctx->demux, buf, len);
+
+	for (i = 0; i < stream_ctx->num; i++)
+		ptx_chrdev_put_stream_commit(stream_ctx->chrdev[i]);
+
+	return 0;
+}
+
+static int emu_chrdev_init(struct ptx_chrdev *chrdev)
+{
+	dev_dbg(chrdev->parent->dev, "emu_chrdev_init\n");
+
+	chrdev->params.system = PTX_UNSPECIFIED_SYSTEM;
+	return 0;
+}
+
+static int emu_chrdev_term(struct ptx_chrdev *chrdev)
+{
+	dev_dbg(chrdev->parent->dev, "emu_chrdev_term\n");
+	return 0;
+}
+
+static int emu_chrdev_open(struct ptx_chrdev *chrdev)
+{
+	struct emu_device *emu = chrdev->priv;
+
+	dev_dbg(emu->dev,
+		"emu_chrdev_open %u:%u\n", chrdev->parent->id, chrdev->id);
+
+	kref_get(&emu->kref);
+	return 0;
+}
+
+static int emu_chrdev_release(struct ptx_chrdev *chrdev)
+{
+	struct emu_device *emu = chrdev->priv;
+
+	dev_dbg(emu->dev,
+		"emu_chrdev_release %u:%u: kref count: %u\n",
+		chrdev->parent->id, chrdev->id, kref_read(&emu->kref));
+
+	kref_put(&emu->kref, emu_device_release);
+	return 0;
+}
+
+static int emu_chrdev_tune(struct ptx_chrdev *chrdev,
+			   struct ptx_tune_params *params)
+{
+	switch (params->system) {
+	case PTX_ISDB_T_SYSTEM:
+	case PTX_ISDB_S_SYSTEM:
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int emu_chrdev_check_lock(struct ptx_chrdev *chrdev, bool *locked)
+{
+	*locked = true;
+	return 0;
+}
+
+static int emu_chrdev_set_stream_id(struct ptx_chrdev *chrdev,
+				    u16 stream_id)
+{
+	return (chrdev->current_system == PTX_ISDB_S_SYSTEM) ? 0 : -EINVAL;
+}
+
+static int emu_chrdev_start_capture(struct ptx_chrdev *chrdev)
+{
+	int ret = 0;
+	struct ptx_chrdev_group *chrdev_group = chrdev->parent;
+	struct emu_device *emu = chrdev->priv;
+
+	dev_dbg(emu->dev,
+		"emu_chrdev_start_capture %u:%u\n",
+		chrdev_group->id, chrdev->id);
+
+	mutex_lock(&emu->lock);
+
+	if (!emu->streaming_count) {
+		struct emu_stream_context *stream_ctx = emu->stream_ctx;
+		struct itedtv_bus *bus = &emu->it930x.bus;
+
+		bus->emu.capture = emu_capture;
+		bus->emu.bitrate = emu_bitrate;
+		bus->emu.chunk_size = 188 * max(emu_chunk_packets, 1U);
+
+		ts_demux_reset(&stream_ctx->demux);
+
+		ret = itedtv_bus_start_streaming(bus,
+						 emu_device_stream_handler,
+						 stream_ctx);
+		if (ret) {
+			dev_err(emu->dev,
+				"emu_chrdev_start_capture %u:%u: itedtv_bus_start_streaming() failed. (ret: %d)\n",
+				chrdev_group->id, chrdev->id, ret);
+			goto exit;
+		}
+	}
+
+	emu->streaming_count++;
+
+	dev_dbg(emu->dev,
+		"emu_chrdev_start_capture %u:%u: streaming_count: %u\n",
+		chrdev_group->id, chrdev->id, emu->streaming_count);
+
+exit:
+	mutex_unlock(&emu->lock);
+	return ret;
+}
+
+static int emu_chrdev_stop_capture(struct ptx_chrdev *chrdev)
+{
+	struct ptx_chrdev_group *chrdev_group = chrdev->parent;
+	struct emu_device *emu = chrdev->priv;
+
+	dev_dbg(emu->dev,
+		"emu_chrdev_stop_capture %u:%u\n",
+		chrdev_group->id, chrdev->id);
+
+	mutex_lock(&emu->lock);
+
+	if (!emu->streaming_count) {
+		mutex_unlock(&emu->lock);
+		return -EALREADY;
+	}
+
+	emu->streaming_count--;
+	if (!emu->streaming_count)
+		itedtv_bus_stop_streaming(&emu->it930x.bus);
+
+	mutex_unlock(&emu->lock);
+	return 0;
+}
+
+static int emu_chrdev_set_capture(struct ptx_chrdev *chrdev, bool status)
+{
+	return (status) ? emu_chrdev_start_capture(chrdev)
+			: emu_chrdev_stop_capture(chrdev);
+}
+
+static struct ptx_chrdev_operations emu_chrdev_ops = {
+	.init = emu_chrdev_init,
+	.term = emu_chrdev_term,
+	.open = emu_chrdev_open,
+	.release = emu_chrdev_release,
+	.tune = emu_chrdev_tune,
+	.check_lock = emu_chrdev_check_lock,
+	.set_stream_id = emu_chrdev_set_stream_id,
+	.set_lnb_voltage = NULL,
+	.set_capture = emu_chrdev_set_capture,
+	.read_signal_strength = NULL,
+	.read_cnr = NULL,
+	.read_cnr_raw = NULL,
+	.set_pid_filter = NULL
+};
+
+static int emu_device_init(struct emu_device *emu, struct device *dev,
+			   unsigned int num,
+			   struct ptx_chrdev_context *chrdev_ctx,
+			   struct completion *quit_completion)
+{
+	int ret = 0, i;
+	struct it930x_bridge *it930x;
+	struct itedtv_bus *bus;
+	struct ptx_chrdev_config chrdev_config[EMU_CHRDEV_MAX_NUM];
+	struct ptx_chrdev_group_config chrdev_group_config;
+	struct ptx_chrdev_group *chrdev_group;
+	struct emu_stream_context *stream_ctx;
+
+	if (!emu || !dev || !num || num > EMU_CHRDEV_MAX_NUM ||
+	    !chrdev_ctx || !quit_completion)
+		return -EINVAL;
+
+	dev_dbg(dev, "emu_device_init\n");
+
+	get_device(dev);
+
+	mutex_init(&emu->lock);
+	kref_init(&emu->kref);
+	emu->dev = dev;
+	emu->quit_completion = quit_completion;
+	emu->streaming_count = 0;
+
+	stream_ctx = kzalloc(sizeof(*stream_ctx), GFP_KERNEL);
+	if (!stream_ctx) {
+		dev_err(emu->dev,
+			"emu_device_init: kzalloc(sizeof(*stream_ctx), GFP_KERNEL) failed.\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	emu->stream_ctx = stream_ctx;
+
+	it930x = &emu->it930x;
+	bus = &it930x->bus;
+
+	bus->dev = dev;
+	bus->type = ITEDTV_BUS_EMU;
+
+	it930x->dev = dev;
+	it930x->config.xfer_size = 188 * 816;
+	it930x->config.i2c_speed = 0x07;
+
+	ret = itedtv_bus_init(bus);
+	if (ret)
+		goto fail_bus;
+
+	ret = it930x_init(it930x);
+	if (ret)
+		goto fail_bridge;
+
+	ret = it930x_raise(it930x);
+	if (ret)
+		goto fail_device;
+
+	/*
+	 * The emulated bridge always reports a running firmware, and
+	 * it930x_init_warm() sets up the USB endpoints, so both are skipped.
+	 */
+
+	for (i = 0; i < num; i++) {
+		chrdev_config[i].system_cap = PTX_ISDB_T_SYSTEM | PTX_ISDB_S_SYSTEM;
+		chrdev_config[i].ops = &emu_chrdev_ops;
+		chrdev_config[i].options = 0;
+		chrdev_config[i].ringbuf_size = 188 * px4_device_params.tsdev_max_packets;
+		chrdev_config[i].ringbuf_threshold_size = chrdev_config[i].ringbuf_size / 10;
+		chrdev_config[i].priv = emu;
+	}
+
+	chrdev_group_config.owner_kref = &emu->kref;
+	chrdev_group_config.owner_kref_release = emu_device_release;
+	chrdev_group_config.reserved = false;
+	chrdev_group_config.minor_base = 0;	/* unused */
+	chrdev_group_config.chrdev_num = num;
+	chrdev_group_config.chrdev_config = chrdev_config;
+	chrdev_group_config.stream_stats = &stream_ctx->demux.stats;
+
+	ret = ptx_chrdev_context_add_group(chrdev_ctx, dev,
+					   &chrdev_group_config, &chrdev_group);
+	if (ret)
+		goto fail_chrdev;
+
+	emu->chrdev_group = chrdev_group;
+
+	for (i = 0; i < num; i++)
+		stream_ctx->chrdev[i] = &chrdev_group->chrdev[i];
+
+	stream_ctx->num = num;
+
+	ts_demux_init(&stream_ctx->demux,
+		      (emu_tagged) ? TS_DEMUX_FORMAT_TAGGED
+				   : TS_DEMUX_FORMAT_PLAIN,
+		      num, emu_device_stream_put, stream_ctx);
+
+	atomic_set(&emu->available, 1);
+	return 0;
+
+fail_chrdev:
+
+fail_device:
+	it930x_term(it930x);
+
+fail_bridge:
+	itedtv_bus_term(bus);
+
+fail_bus:
+	kfree(emu->stream_ctx);
+
+fail:
+	mutex_destroy(&emu->lock);
+	put_device(dev);
+	return ret;
+}
+
+static void emu_device_release(struct kref *kref)
+{
+	struct emu_device *emu = container_of(kref, struct emu_device, kref);
+
+	dev_dbg(emu->dev, "emu_device_release\n");
+
+	it930x_term(&emu->it930x);
+	itedtv_bus_term(&emu->it930x.bus);
+
+	kfree(emu->stream_ctx);
+	mutex_destroy(&emu->lock);
+	put_device(emu->dev);
+
+	complete(emu->quit_completion);
+	return;
+}
+
+static void emu_device_term(struct emu_device *emu)
+{
+	dev_dbg(emu->dev,
+		"emu_device_term: kref count: %u\n",
+		kref_read(&emu->kref));
+
+	atomic_xchg(&emu->available, 0);
+	ptx_chrdev_group_destroy(emu->chrdev_group);
+
+	kref_put(&emu->kref, emu_device_release);
+	return;
+}
+
+int emu_device_register(void)
+{
+	int ret = 0;
+	unsigned int num = emu_tuners;
+
+	if (!num)
+		return 0;
+
+	if (!emu_tagged && num > 1) {
+		pr_warn("emu_device_register: a plain capture has only one stream. (emu_tuners: %u)\n",
+			num);
+		num = 1;
+	} else if (num > EMU_CHRDEV_MAX_NUM) {
+		num = EMU_CHRDEV_MAX_NUM;
+	}
+
+	ret = ptx_chrdev_context_create("pxemu", "pxemuvideo",
+					EMU_CHRDEV_MAX_NUM, &emu_chrdev_ctx);
+	if (ret) {
+		pr_err("emu_device_register: ptx_chrdev_context_create(\"pxemu\") failed.\n");
+		goto fail;
+	}
+
+	emu_root_dev = root_device_register("px4_drv_emu");
+	if (IS_ERR(emu_root_dev)) {
+		ret = PTR_ERR(emu_root_dev);
+		pr_err("emu_device_register: root_device_register() failed. (ret: %d)\n",
+		       ret);
+		goto fail_root;
+	}
+
+	emu_dev = kzalloc(sizeof(*emu_dev), GFP_KERNEL);
+	if (!emu_dev) {
+		ret = -ENOMEM;
+		goto fail_alloc;
+	}
+
+	init_completion(&emu_quit_completion);
+
+	ret = emu_device_init(emu_dev, emu_root_dev, num,
+			      emu_chrdev_ctx, &emu_quit_completion);
+	if (ret) {
+		pr_err("emu_device_register: emu_device_init() failed. (ret: %d)\n",
+		       ret);
+		goto fail_device;
+	}
+
+	return 0;
+
+fail_device:
+	kfree(emu_dev);
+	emu_dev = NULL;
+
+fail_alloc:
+	root_device_unregister(emu_root_dev);
+
+fail_root:
+	emu_root_dev = NULL;
+	ptx_chrdev_context_destroy(emu_chrdev_ctx);
+	emu_chrdev_ctx = NULL;
+
+fail:
+	return ret;
+}
+
+void emu_device_unregister(void)
+{
+	if (!emu_dev)
+		return;
+
+	emu_device_term(emu_dev);
+	wait_for_completion(&emu_quit_completion);
+
+	kfree(emu_dev);
+	emu_dev = NULL;
+
+	root_device_unregister(emu_root_dev);
+	emu_root_dev = NULL;
+
+	ptx_chrdev_context_destroy(emu_chrdev_ctx);
+	emu_chrdev_ctx = NULL;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PTX driver definitions for the emulated device (emu_device.h)
+ */
+
+#ifndef __EMU_DEVICE_H__
+#define __EMU_DEVICE_H__
+
+#include <linux/atomic.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/device.h>
+
+#include "ptx_chrdev.h"
+#include "it930x.h"
+
+#define EMU_CHRDEV_MAX_NUM	7
+
+struct emu_device {
+	struct mutex lock;
+	struct kref kref;
+	atomic_t available;
+	struct device *dev;
+	struct completion *quit_completion;
+	unsigned int streaming_count;
+	struct ptx_chrdev_group *chrdev_group;
+	struct it930x_bridge it930x;
+	void *stream_ctx;
+};
+
+int emu_device_register(void);
+void emu_device_unregister(void);
+
+#endif
@@ -14,14 +14,11 @@
 
 #include "px4_device_params.h"
 #include "firmware.h"
-
-#define ISDB2056_DEVICE_TS_SYNC_COUNT	4
-#define ISDB2056_DEVICE_TS_SYNC_SIZE	(188 * ISDB2056_DEVICE_TS_SYNC_COUNT)
+#include "ts_demux.h"
 
 struct isdb2056_stream_context {
 	struct ptx_chrdev *chrdev;
-	u8 remain_buf[ISDB2056_DEVICE_TS_SYNC_SIZE];
-	size_t remain_len;
+	struct ts_demux demux;
 };
 
 static void isdb2056_device_release(struct kref *kref);
@@ -123,86 +120,18 @@ static int isdb2056_backend_term(struct isdb2056_device *isdb2056)
 	return 0;
 }
 
-static void isdb2056_device_stream_process(struct ptx_chrdev *chrdev,
-					   u8 **buf, u32 *len)
+static void isdb2056_device_stream_put(void *context, int id, u8 *buf, u32 len)
 {
-	u8 *p = *buf;
-	u32 remain = *len;
-
-	while (likely(remain)) {
-		u32 i = 0;
-		bool sync_remain = false;
-
-		while (true) {
-			if (likely(((i + 1) * 188) <= remain)) {
-				if (unlikely(p[i * 188] != 0x47))
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-			i++;
-		}
-
-		if (unlikely(i < ISDB2056_DEVICE_TS_SYNC_COUNT)) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		ptx_chrdev_put_stream(chrdev, p, 188 * i);
-
-		p += 188 * i;
-		remain -= 188 * i;
-
-		if (unlikely(sync_remain))
-			break;
-	}
-
-	*buf = p;
-	*len = remain;
+	struct isdb2056_stream_context *stream_ctx = context;
 
-	return;
+	ptx_chrdev_put_stream(stream_ctx->chrdev, buf, len);
 }
 
 static int isdb2056_device_stream_handler(void *context, void *buf, u32 len)
 {
 	struct isdb2056_stream_context *stream_ctx = context;
-	u8 *ctx_remain_buf = stream_ctx->remain_buf;
-	u32 ctx_remain_len = stream_ctx->remain_len;
-	u8 *p = buf;
-	u32 remain = len;
-
-	if (unlikely(ctx_remain_len)) {
-		if (likely((ctx_remain_len + len) >= ISDB2056_DEVICE_TS_SYNC_SIZE)) {
-			u32 t = ISDB2056_DEVICE_TS_SYNC_SIZE - ctx_remain_len;
-
-			memcpy(ctx_remain_buf + ctx_remain_len, p, t);
-			ctx_remain_len = ISDB2056_DEVICE_TS_SYNC_SIZE;
-
-			isdb2056_device_stream_process(stream_ctx->chrdev,
-						  &ctx_remain_buf,
-						  &ctx_remain_len);
-			if (likely(!ctx_remain_len)) {
-				p += t;
-				remain -= t;
-			}
-
-			stream_ctx->remain_len = 0;
-		} else {
-			memcpy(ctx_remain_buf + ctx_remain_len, p, len);
-			stream_ctx->remain_len += len;
-
-			return 0;
-		}
-	}
-
-	isdb2056_device_stream_process(stream_ctx->chrdev, &p, &remain);
 
-	if (unlikely(remain)) {
-		memcpy(stream_ctx->remain_buf, p, remain);
-		stream_ctx->remain_len = remain;
-	}
+	ts_demux_process(&stream_ctx->demux, buf, len);
 
 	return 0;
 }
@@ -774,7 +703,7 @@ static int isdb2056_chrdev_start_capture(struct ptx_chrdev *chrdev)
 	if (ret)
 		goto fail_tc;
 
-	stream_ctx->remain_len = 0;
+	ts_demux_reset(&stream_ctx->demux);
 
 	ret = itedtv_bus_start_streaming(&isdb2056->it930x.bus,
 					 isdb2056_device_stream_handler,
@@ -868,6 +797,18 @@ static int isdb2056_chrdev_read_cnr_raw(struct ptx_chrdev *chrdev, u32 *value)
 	return ret;
 }
 
+static int isdb2056_chrdev_set_pid_filter(struct ptx_chrdev *chrdev,
+					  const struct ptx_hw_pid_filter *filter)
+{
+	struct isdb2056_chrdev *chrdev2056 = chrdev->priv;
+	struct isdb2056_device *isdb2056 = container_of(chrdev2056,
+							struct isdb2056_device,
+							chrdev2056);
+
+	return it930x_apply_ptx_pid_filter(&isdb2056->it930x, 0, filter,
+					   px4_device_params.discard_null_packets);
+}
+
 static struct ptx_chrdev_operations isdb2056_chrdev_ops = {
 	.init = isdb2056_chrdev_init,
 	.term = isdb2056_chrdev_term,
@@ -880,7 +821,8 @@ static struct ptx_chrdev_operations isdb2056_chrdev_ops = {
 	.set_capture = isdb2056_chrdev_set_capture,
 	.read_signal_strength = NULL,
 	.read_cnr = NULL,
-	.read_cnr_raw = isdb2056_chrdev_read_cnr_raw
+	.read_cnr_raw = isdb2056_chrdev_read_cnr_raw,
+	.set_pid_filter = isdb2056_chrdev_set_pid_filter
 };
 
 static int isdb2056_device_load_config(struct isdb2056_device *isdb2056,
@@ -1085,6 +1027,7 @@ int isdb2056_device_init(struct isdb2056_device *isdb2056, struct device *dev,
 	chrdev_group_config.minor_base = 0;	/* unused */
 	chrdev_group_config.chrdev_num = 1;
 	chrdev_group_config.chrdev_config = &chrdev_config;
+	chrdev_group_config.stream_stats = &stream_ctx->demux.stats;
 
 	ret = ptx_chrdev_context_add_group(chrdev_ctx, dev,
 					   &chrdev_group_config, &chrdev_group);
@@ -1094,6 +1037,8 @@ int isdb2056_device_init(struct isdb2056_device *isdb2056, struct device *dev,
 	isdb2056->chrdev_group = chrdev_group;
 	isdb2056->chrdev2056.chrdev = &chrdev_group->chrdev[0];
 	stream_ctx->chrdev = &chrdev_group->chrdev[0];
+	ts_demux_init(&stream_ctx->demux, TS_DEMUX_FORMAT_PLAIN,
+		      1, isdb2056_device_stream_put, stream_ctx);
 
 	atomic_set(&isdb2056->available, 1);
 	return 0;
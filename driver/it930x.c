@@ -14,6 +14,8 @@
 #include <linux/slab.h>
 #include <linux/mutex.h>
 #include <linux/firmware.h>
+
+#include "ptx_ioctl.h"
 #endif
 
 struct it930x_i2c_master_info {
@@ -55,10 +57,10 @@ static inline u8 it930x_reg_length(u32 reg)
 	return 1;
 }
 
-static u16 it930x_calc_checksum(void *buf, size_t len)
+u16 it930x_calc_checksum(const void *buf, size_t len)
 {
 	int i;
-	u8 *b;
+	const u8 *b;
 	u16 c = 0;
 
 	i = (int)(len / 2);
@@ -83,9 +85,9 @@ static int it930x_ctrl_msg(struct it930x_bridge *it930x,
 {
 	int ret;
 	struct it930x_priv *priv = it930x->priv;
-	u8 *buf, len, seq;
+	u8 *buf, seq;
 	u16 csum, csum2;
-	int rlen = 256;
+	int len, rlen = 256;
 
 	if (wbuf && wbuf->len > (255 - 3 - 2))
 		return -EINVAL;
@@ -1126,6 +1128,35 @@ int it930x_set_pid_filter(struct it930x_bridge *it930x, int input_idx,
 	return 0;
 }
 
+#ifdef __linux__
+int it930x_apply_ptx_pid_filter(struct it930x_bridge *it930x, int input_idx,
+				const struct ptx_hw_pid_filter *filter,
+				bool discard_null_packets)
+{
+	struct it930x_pid_filter pid_filter;
+
+	if (filter) {
+		if (filter->num < 0 ||
+		    filter->num > ARRAY_SIZE(pid_filter.pid))
+			return -EINVAL;
+
+		pid_filter.block = (filter->mode == PTX_HW_PID_FILTER_BLOCK);
+		pid_filter.num = filter->num;
+		memcpy(pid_filter.pid, filter->pid,
+		       sizeof(pid_filter.pid[0]) * filter->num);
+	} else if (discard_null_packets) {
+		/* same as the filter set up at init */
+		pid_filter.block = true;
+		pid_filter.num = 1;
+		pid_filter.pid[0] = 0x1fff;
+	} else {
+		pid_filter.num = 0;
+	}
+
+	return it930x_set_pid_filter(it930x, input_idx, &pid_filter);
+}
+#endif
+
 int it930x_purge_psb(struct it930x_bridge *it930x, int timeout)
 {
 	int ret = 0;
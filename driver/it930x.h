@@ -32,6 +32,10 @@ enum it930x_gpio_mode {
 	IT930X_GPIO_OUT,
 };
 
+#ifdef __linux__
+struct ptx_hw_pid_filter;
+#endif
+
 struct it930x_pid_filter {
 	bool block;
 	int num;
@@ -66,6 +70,7 @@ struct it930x_bridge {
 #ifdef __cplusplus
 extern "C" {
 #endif
+u16 it930x_calc_checksum(const void *buf, size_t len);
 int it930x_read_regs(struct it930x_bridge *it930x,
 		     u32 reg,
 		     u8 *rbuf, u8 len);
@@ -93,6 +98,11 @@ int it930x_read_gpio(struct it930x_bridge *it930x, int gpio, bool *high);
 int it930x_write_gpio(struct it930x_bridge *it930x, int gpio, bool high);
 int it930x_set_pid_filter(struct it930x_bridge *it930x, int input_idx,
 			  struct it930x_pid_filter *filter);
+#ifdef __linux__
+int it930x_apply_ptx_pid_filter(struct it930x_bridge *it930x, int input_idx,
+				const struct ptx_hw_pid_filter *filter,
+				bool discard_null_packets);
+#endif
 int it930x_purge_psb(struct it930x_bridge *it930x, int timeout);
 #ifdef __cplusplus
 }
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the IT930x control framing (it930x_test.c)
+ */
+
+#include "it930x.c"
+
+#include <linux/slab.h>
+#include <linux/ktime.h>
+
+#include "px4_drv_test.h"
+
+#define IT930X_TEST_BENCH_FRAME	250
+
+enum it930x_test_fault {
+	IT930X_TEST_FAULT_NONE = 0,
+	IT930X_TEST_FAULT_CHECKSUM,
+	IT930X_TEST_FAULT_SEQUENCE,
+	IT930X_TEST_FAULT_STATUS,
+};
+
+/* a device which answers register requests from a small register file */
+struct it930x_test_device {
+	struct it930x_bridge it930x;
+	struct kunit *test;
+	enum it930x_test_fault fault;
+	u8 regs[256];	// indexed by the low byte of the address
+	u8 resp[256];
+	int resp_len;
+};
+
+static u16 it930x_test_frame_checksum(const u8 *buf, int len)
+{
+	return it930x_calc_checksum(&buf[1], len - 1 - 2);
+}
+
+static int it930x_test_ctrl_tx(struct itedtv_bus *bus, void *buf, int len)
+{
+	struct it930x_test_device *dev = container_of(bus,
+						      struct it930x_test_device,
+						      it930x.bus);
+	struct kunit *test = dev->test;
+	u8 *b = buf, *p = &b[4], *r = dev->resp;
+	u8 status = 0, n = 0;
+	u32 reg;
+	u16 csum;
+	int i;
+
+	if (len < 4 + 6 + 2) {
+		KUNIT_FAIL(test, "too short request (len: %d)", len);
+		return -EINVAL;
+	}
+
+	KUNIT_EXPECT_EQ(test, b[0], (u8)(len - 1));
+
+	csum = it930x_test_frame_checksum(b, len);
+	KUNIT_EXPECT_EQ(test, csum, (u16)((b[len - 2] << 8) | b[len - 1]));
+
+	/* p[0]: length, p[1]: address length, p[2..5]: address */
+	reg = (p[2] << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+	KUNIT_EXPECT_EQ(test, p[1], it930x_reg_length(reg));
+
+	switch ((b[1] << 8) | b[2]) {
+	case IT930X_CMD_REG_READ:
+		n = p[0];
+		for (i = 0; i < n; i++)
+			r[3 + i] = dev->regs[(reg + i) & 0xff];
+		break;
+
+	case IT930X_CMD_REG_WRITE:
+		KUNIT_EXPECT_EQ(test, len, 4 + 6 + p[0] + 2);
+		for (i = 0; i < p[0]; i++)
+			dev->regs[(reg + i) & 0xff] = p[6 + i];
+		break;
+
+	default:
+		status = 1;
+		break;
+	}
+
+	dev->resp_len = 3 + n + 2;
+
+	r[0] = dev->resp_len - 1;
+	r[1] = b[3];
+	r[2] = status;
+
+	if (dev->fault == IT930X_TEST_FAULT_SEQUENCE)
+		r[1]++;
+	else if (dev->fault == IT930X_TEST_FAULT_STATUS)
+		r[2] = 1;
+
+	csum = it930x_test_frame_checksum(r, dev->resp_len);
+	if (dev->fault == IT930X_TEST_FAULT_CHECKSUM)
+		csum ^= 0x0100;
+
+	r[dev->resp_len - 2] = (csum >> 8) & 0xff;
+	r[dev->resp_len - 1] = csum & 0xff;
+
+	return 0;
+}
+
+static int it930x_test_ctrl_rx(struct itedtv_bus *bus, void *buf, int *len)
+{
+	struct it930x_test_device *dev = container_of(bus,
+						      struct it930x_test_device,
+						      it930x.bus);
+
+	if (*len < dev->resp_len)
+		return -EOVERFLOW;
+
+	memcpy(buf, dev->resp, dev->resp_len);
+	*len = dev->resp_len;
+
+	return 0;
+}
+
+static struct it930x_test_device *it930x_test_create(struct kunit *test)
+{
+	struct it930x_test_device *dev;
+
+	dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dev);
+
+	dev->test = test;
+	dev->it930x.bus.ops.ctrl_tx = it930x_test_ctrl_tx;
+	dev->it930x.bus.ops.ctrl_rx = it930x_test_ctrl_rx;
+
+	KUNIT_ASSERT_EQ(test, it930x_init(&dev->it930x), 0);
+
+	return dev;
+}
+
+static void it930x_test_checksum(struct kunit *test)
+{
+	static const u8 even[] = { 0x01, 0x02, 0x03, 0x04 };
+	static const u8 odd[] = { 0x01, 0x02, 0x03 };
+	static const u8 ones[] = { 0xff, 0xff, 0x00, 0x01 };
+
+	KUNIT_EXPECT_EQ(test, it930x_calc_checksum(even, sizeof(even)),
+			(u16)0xfbf9);
+	KUNIT_EXPECT_EQ(test, it930x_calc_checksum(odd, sizeof(odd)),
+			(u16)0xfbfd);
+	KUNIT_EXPECT_EQ(test, it930x_calc_checksum(even, 0), (u16)0xffff);
+
+	/* the sum wraps around in 16 bits */
+	KUNIT_EXPECT_EQ(test, it930x_calc_checksum(ones, sizeof(ones)),
+			(u16)0xffff);
+}
+
+static void it930x_test_round_trip(struct kunit *test)
+{
+	static const u32 regs[] = { 0x00, 0xf3, 0xda10, 0x4978, 0x12f100 };
+	struct it930x_test_device *dev = it930x_test_create(test);
+	u8 wbuf[244], rbuf[244], val;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(regs); i++) {
+		u8 len = (i % 2) ? 1 : 13;
+
+		px4_drv_test_fill(wbuf, len, regs[i]);
+		memset(rbuf, 0, len);
+
+		KUNIT_EXPECT_EQ(test,
+				it930x_write_regs(&dev->it930x, regs[i],
+						  wbuf, len), 0);
+		KUNIT_EXPECT_EQ(test,
+				it930x_read_regs(&dev->it930x, regs[i],
+						 rbuf, len), 0);
+		KUNIT_EXPECT_EQ(test, memcmp(wbuf, rbuf, len), 0);
+	}
+
+	/* the largest frames in both directions */
+	px4_drv_test_fill(wbuf, sizeof(wbuf), 0);
+	KUNIT_EXPECT_EQ(test,
+			it930x_write_regs(&dev->it930x, 0x00, wbuf,
+					  sizeof(wbuf)), 0);
+	KUNIT_EXPECT_EQ(test,
+			it930x_read_regs(&dev->it930x, 0x00, rbuf,
+					 sizeof(rbuf)), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(wbuf, rbuf, sizeof(rbuf)), 0);
+
+	KUNIT_EXPECT_EQ(test, it930x_write_reg_mask(&dev->it930x, 0x20,
+						    0x0f, 0x3c), 0);
+	KUNIT_EXPECT_EQ(test, it930x_read_reg(&dev->it930x, 0x20, &val), 0);
+	KUNIT_EXPECT_EQ(test, val, (u8)((wbuf[0x20] & ~0x3c) | 0x0c));
+
+	KUNIT_EXPECT_EQ(test,
+			it930x_write_regs(&dev->it930x, 0x00, wbuf,
+					  sizeof(wbuf) + 1), -EINVAL);
+
+	it930x_term(&dev->it930x);
+}
+
+static void it930x_test_bad_response(struct kunit *test)
+{
+	struct it930x_test_device *dev = it930x_test_create(test);
+	u8 val = 0x5a;
+
+	dev->fault = IT930X_TEST_FAULT_CHECKSUM;
+	KUNIT_EXPECT_EQ(test, it930x_write_reg(&dev->it930x, 0x10, val),
+			-EBADMSG);
+
+	dev->fault = IT930X_TEST_FAULT_SEQUENCE;
+	KUNIT_EXPECT_EQ(test, it930x_read_reg(&dev->it930x, 0x10, &val),
+			-EBADMSG);
+
+	dev->fault = IT930X_TEST_FAULT_STATUS;
+	KUNIT_EXPECT_EQ(test, it930x_read_reg(&dev->it930x, 0x10, &val),
+			-EIO);
+
+	/* a failed exchange must not upset the next one */
+	dev->fault = IT930X_TEST_FAULT_NONE;
+	KUNIT_EXPECT_EQ(test, it930x_write_reg(&dev->it930x, 0x10, 0xa5), 0);
+	KUNIT_EXPECT_EQ(test, it930x_read_reg(&dev->it930x, 0x10, &val), 0);
+	KUNIT_EXPECT_EQ(test, val, (u8)0xa5);
+
+	it930x_term(&dev->it930x);
+}
+
+static void it930x_test_bench(struct kunit *test)
+{
+	u8 *buf;
+	u64 total = 0, start, ns;
+	u16 csum = 0;
+
+	buf = kunit_kmalloc(test, IT930X_TEST_BENCH_FRAME, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	px4_drv_test_fill(buf, IT930X_TEST_BENCH_FRAME, 0);
+
+	start = ktime_get_ns();
+
+	while (total < PX4_DRV_TEST_BENCH_SIZE) {
+		csum ^= it930x_calc_checksum(buf, IT930X_TEST_BENCH_FRAME);
+		buf[0]++;
+		total += IT930X_TEST_BENCH_FRAME;
+	}
+
+	ns = ktime_get_ns() - start;
+
+	/* keeps the loop from being optimized away */
+	kunit_info(test, "checksum: 0x%04x\n", csum);
+	px4_drv_test_report(test, "it930x checksum", total, ns);
+}
+
+static struct kunit_case it930x_test_cases[] = {
+	KUNIT_CASE(it930x_test_checksum),
+	KUNIT_CASE(it930x_test_round_trip),
+	KUNIT_CASE(it930x_test_bad_response),
+	KUNIT_CASE(it930x_test_bench),
+	{}
+};
+
+struct kunit_suite it930x_test_suite = {
+	.name = "px4_drv_it930x",
+	.test_cases = it930x_test_cases,
+};
@@ -7,12 +7,32 @@
 
 #include "print_format.h"
 #include "itedtv_bus.h"
+#ifdef ITEDTV_BUS_USE_EMU
+#include "itedtv_bus_emu.h"
+#endif
 
 #ifdef __linux__
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/atomic.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/gcd.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+#include <uapi/linux/sched/types.h>
+#endif
+
+#include "ptx_trace.h"
 #endif
 
 #if defined(ITEDTV_BUS_USE_WORKQUEUE) && !defined(__linux__)
@@ -27,6 +47,11 @@ struct itedtv_usb_work {
 #ifdef ITEDTV_BUS_USE_WORKQUEUE
 	struct work_struct work;
 #endif
+#ifdef __linux__
+	struct list_head list;
+	unsigned int recover_delay;	// in msecs, doubled on each failure
+	unsigned long recover_at;	// in jiffies
+#endif
 };
 
 struct itedtv_usb_context {
@@ -42,6 +67,26 @@ struct itedtv_usb_context {
 	u32 num_works;
 	struct itedtv_usb_work *works;
 	atomic_t streaming;
+#ifdef __linux__
+	bool use_thread;
+	struct task_struct *thread;
+	spinlock_t done_lock;
+	struct list_head done_list;
+	wait_queue_head_t done_wait;
+	struct list_head failed_list;	// protected by done_lock
+	unsigned long recover_at;	// protected by done_lock
+	bool halted;	// protected by done_lock
+	struct delayed_work recover_work;
+	atomic_t in_flight;
+	struct itedtv_bus_stats counters;	// protected by done_lock
+	struct {
+		u64 completions;
+		u64 bytes;
+		ktime_t start;
+		ktime_t last;
+		s64 max_jitter;	// in nsecs
+	} stats;
+#endif
 };
 
 static int itedtv_usb_ctrl_tx(struct itedtv_bus *bus, void *buf, int len)
@@ -117,6 +162,155 @@ static int itedtv_usb_stream_rx(struct itedtv_bus *bus,
 	return ret;
 }
 
+#ifdef __linux__
+#define ITEDTV_USB_RECOVER_MIN_DELAY	1	// in msecs
+#define ITEDTV_USB_RECOVER_MAX_DELAY	1000	// in msecs
+
+static int itedtv_usb_submit_urb(struct itedtv_usb_context *ctx,
+				 struct urb *urb, gfp_t mem_flags)
+{
+	int ret = 0;
+	unsigned long flags;
+
+	atomic_inc(&ctx->in_flight);
+
+	ret = usb_submit_urb(urb, mem_flags);
+	if (unlikely(ret)) {
+		atomic_dec(&ctx->in_flight);
+
+		spin_lock_irqsave(&ctx->done_lock, flags);
+		ctx->counters.submit_errors++;
+		spin_unlock_irqrestore(&ctx->done_lock, flags);
+	}
+
+	return ret;
+}
+
+/*
+ * Keeps an URB which has failed aside, and lets the recover work submit it
+ * again later, so that transient errors do not shrink the URB pool.
+ */
+static void itedtv_usb_defer_urb(struct itedtv_usb_context *ctx,
+				 struct itedtv_usb_work *w, int status)
+{
+	unsigned long flags, now;
+
+	switch (status) {
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+	case -ENODEV:
+		/* unlinked, or the device has gone */
+		return;
+
+	default:
+		break;
+	}
+
+	if (atomic_read_acquire(&ctx->streaming) < 1)
+		return;
+
+	spin_lock_irqsave(&ctx->done_lock, flags);
+
+	now = jiffies;
+
+	if (status == -EPIPE) {
+		/* the endpoint has stalled, clear it right away */
+		ctx->halted = true;
+		w->recover_at = now;
+	} else {
+		/* back off while this URB keeps failing */
+		w->recover_at = now + msecs_to_jiffies(w->recover_delay);
+		w->recover_delay = min_t(unsigned int, w->recover_delay * 2,
+					 ITEDTV_USB_RECOVER_MAX_DELAY);
+	}
+
+	if (list_empty(&ctx->failed_list) ||
+	    time_before(w->recover_at, ctx->recover_at)) {
+		ctx->recover_at = w->recover_at;
+		mod_delayed_work(system_wq, &ctx->recover_work,
+				 w->recover_at - now);
+	}
+
+	list_add_tail(&w->list, &ctx->failed_list);
+	ctx->counters.urb_errors++;
+	ctx->counters.last_error = status;
+
+	spin_unlock_irqrestore(&ctx->done_lock, flags);
+}
+
+static void itedtv_usb_recover_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct itedtv_usb_context *ctx = container_of(to_delayed_work(work),
+						      struct itedtv_usb_context,
+						      recover_work);
+	struct usb_device *dev = ctx->bus->usb.dev;
+	struct itedtv_usb_work *w, *tmp;
+	LIST_HEAD(list);
+	unsigned long now;
+	bool halted, pending = false;
+
+	/* take the URBs which are due, and leave the others for later */
+	spin_lock_irq(&ctx->done_lock);
+
+	now = jiffies;
+
+	list_for_each_entry_safe(w, tmp, &ctx->failed_list, list) {
+		if (time_after(w->recover_at, now)) {
+			if (!pending || time_before(w->recover_at, ctx->recover_at))
+				ctx->recover_at = w->recover_at;
+
+			pending = true;
+			continue;
+		}
+
+		list_move_tail(&w->list, &list);
+	}
+
+	if (pending)
+		mod_delayed_work(system_wq, &ctx->recover_work,
+				 ctx->recover_at - now);
+
+	halted = ctx->halted;
+	ctx->halted = false;
+
+	spin_unlock_irq(&ctx->done_lock);
+
+	if (atomic_read_acquire(&ctx->streaming) < 1)
+		return;
+
+	if (halted) {
+		ret = usb_clear_halt(dev, usb_rcvbulkpipe(dev, 0x84));
+		if (ret)
+			dev_err(ctx->bus->dev,
+				"itedtv_usb_recover_work: usb_clear_halt() failed. (ret: %d)\n",
+				ret);
+
+		spin_lock_irq(&ctx->done_lock);
+		ctx->counters.endpoint_resets++;
+		spin_unlock_irq(&ctx->done_lock);
+	}
+
+	list_for_each_entry_safe(w, tmp, &list, list) {
+		list_del(&w->list);
+
+		ret = itedtv_usb_submit_urb(ctx, w->urb, GFP_KERNEL);
+		if (ret) {
+			dev_dbg(ctx->bus->dev,
+				"itedtv_usb_recover_work: usb_submit_urb() failed. (ret: %d)\n",
+				ret);
+			itedtv_usb_defer_urb(ctx, w, ret);
+			continue;
+		}
+
+		spin_lock_irq(&ctx->done_lock);
+		ctx->counters.urb_resubmits++;
+		spin_unlock_irq(&ctx->done_lock);
+	}
+}
+#endif
+
 #ifdef ITEDTV_BUS_USE_WORKQUEUE
 static void itedtv_usb_workqueue_handler(struct work_struct *work)
 {
@@ -137,16 +331,241 @@ static void itedtv_usb_workqueue_handler(struct work_struct *work)
 	if (unlikely(ret || (atomic_read_acquire(&ctx->streaming) < 1)))
 		return;
 
-	ret = usb_submit_urb(urb, GFP_KERNEL);
-	if (unlikely(ret))
+	ret = itedtv_usb_submit_urb(ctx, urb, GFP_KERNEL);
+	if (unlikely(ret)) {
 		dev_err(ctx->bus->dev,
 			"itedtv_usb_workqueue_handler: usb_submit_urb() failed. (ret: %d)\n",
 			ret);
+		itedtv_usb_defer_urb(ctx, w, ret);
+	}
 
 	return;
 }
 #endif
 
+#ifdef __linux__
+#define ITEDTV_USB_AUTO_TUNE_INTERVAL	10	// URB completion interval in msecs
+#define ITEDTV_USB_AUTO_TUNE_WARMUP	100	// in msecs, before jitter is measured
+#define ITEDTV_USB_AUTO_TUNE_MAX_PACKETS	816	// if the transfer size is unknown
+#define ITEDTV_USB_AUTO_TUNE_MAX_URBS	16
+
+/* the fewest TS packets which end on a max packet boundary */
+static u32 itedtv_usb_packets_step(struct itedtv_bus *bus)
+{
+	u32 max_bulk_size = bus->usb.max_bulk_size;
+
+	return max_bulk_size / gcd(188, max_bulk_size);
+}
+
+static void itedtv_usb_update_stats(struct itedtv_usb_context *ctx,
+				    struct urb *urb, u32 in_flight)
+{
+	struct itedtv_bus_stats *counters = &ctx->counters;
+	ktime_t now = ktime_get();
+	u32 len = urb->actual_length;
+	unsigned int fill, interval = ITEDTV_BUS_INTERVAL_BUCKETS;
+	unsigned long flags;
+
+	if (likely(ctx->stats.completions)) {
+		s64 gap = ktime_to_ns(ktime_sub(now, ctx->stats.last));
+		u64 gap_us = div_u64(max_t(s64, gap, 0), NSEC_PER_USEC);
+		s64 elapsed_us = ktime_us_delta(ctx->stats.last, ctx->stats.start);
+
+		/*
+		 * Jitter is how much later than the fill time at the mean rate
+		 * so far this URB has completed.
+		 */
+		if (elapsed_us >= ITEDTV_USB_AUTO_TUNE_WARMUP * USEC_PER_MSEC &&
+		    ctx->stats.bytes) {
+			s64 expected = div64_u64((u64)len * elapsed_us,
+						 ctx->stats.bytes) * NSEC_PER_USEC;
+
+			if (gap - expected > ctx->stats.max_jitter)
+				ctx->stats.max_jitter = gap - expected;
+		}
+
+		interval = (gap_us) ? min_t(unsigned int, ilog2(gap_us) + 1,
+					    ITEDTV_BUS_INTERVAL_BUCKETS - 1) : 0;
+
+		/* the first URB has been filling since before start */
+		ctx->stats.bytes += len;
+	} else {
+		ctx->stats.start = now;
+	}
+
+	ctx->stats.completions++;
+	ctx->stats.last = now;
+
+	fill = min_t(u32, div_u64((u64)len * ITEDTV_BUS_FILL_BUCKETS,
+				  urb->transfer_buffer_length),
+		     ITEDTV_BUS_FILL_BUCKETS - 1);
+
+	spin_lock_irqsave(&ctx->done_lock, flags);
+
+	counters->fill_hist[fill]++;
+
+	if (interval < ITEDTV_BUS_INTERVAL_BUCKETS)
+		counters->interval_hist[interval]++;
+
+	if (in_flight < counters->in_flight_min)
+		counters->in_flight_min = in_flight;
+
+	spin_unlock_irqrestore(&ctx->done_lock, flags);
+}
+
+/*
+ * Picks the URB size and depth for the next session from the bitrate and the
+ * worst completion jitter measured in the session which has just ended.
+ * The URB size stays one that the device transfers fit in.
+ */
+static void itedtv_usb_auto_tune(struct itedtv_usb_context *ctx)
+{
+	struct itedtv_bus *bus = ctx->bus;
+	s64 duration = ktime_to_ns(ktime_sub(ctx->stats.last, ctx->stats.start));
+	u64 rate, interval;
+	u32 packets, max_packets, step, num;
+
+	/* too short to tell */
+	if (duration < NSEC_PER_SEC || !ctx->stats.bytes)
+		return;
+
+	/* bytes per second */
+	rate = div64_u64(ctx->stats.bytes * MSEC_PER_SEC,
+			 div64_u64(duration, NSEC_PER_MSEC));
+	if (!rate)
+		return;
+
+	step = itedtv_usb_packets_step(bus);
+	max_packets = (bus->usb.streaming.xfer_size) ? bus->usb.streaming.xfer_size / 188
+						     : ITEDTV_USB_AUTO_TUNE_MAX_PACKETS;
+
+	packets = div64_u64(rate * ITEDTV_USB_AUTO_TUNE_INTERVAL,
+			    188 * MSEC_PER_SEC);
+	packets = max_t(u32, rounddown(packets, step), step);
+	if (packets > max_packets)
+		packets = max_packets;
+
+	if (!itedtv_bus_usb_urb_size_valid(bus, 188 * packets))
+		packets = rounddown(packets, step);
+
+	if (!packets)
+		return;
+
+	/* keep enough URBs queued to ride out the worst jitter twice over */
+	interval = div64_u64((u64)188 * packets * NSEC_PER_SEC, rate);
+	num = div64_u64((u64)ctx->stats.max_jitter * 2 + interval - 1, interval) + 1;
+	num = clamp_t(u32, num, 2, ITEDTV_USB_AUTO_TUNE_MAX_URBS);
+
+	dev_dbg(bus->dev,
+		"itedtv_usb_auto_tune: rate: %llu, max_jitter: %lld, packets: %u, num: %u\n",
+		rate, ctx->stats.max_jitter, packets, num);
+
+	WRITE_ONCE(bus->usb.streaming.urb_buffer_size, 188 * packets);
+	WRITE_ONCE(bus->usb.streaming.urb_num, num);
+}
+#endif
+
+#ifdef __linux__
+/*
+ * The processing thread runs the stream handler for the URBs which the
+ * completion handler hands over, and submits them again.
+ */
+static int itedtv_usb_thread(void *data)
+{
+	struct itedtv_usb_context *ctx = data;
+	LIST_HEAD(list);
+
+	while (!kthread_should_stop()) {
+		struct itedtv_usb_work *w, *tmp;
+
+		wait_event_interruptible(ctx->done_wait,
+					 !list_empty_careful(&ctx->done_list) ||
+					 kthread_should_stop());
+
+		spin_lock_irq(&ctx->done_lock);
+		list_splice_init(&ctx->done_list, &list);
+		spin_unlock_irq(&ctx->done_lock);
+
+		list_for_each_entry_safe(w, tmp, &list, list) {
+			int ret = 0;
+			struct urb *urb = w->urb;
+
+			list_del(&w->list);
+
+			if (likely(urb->actual_length))
+				ret = ctx->stream_handler(ctx->ctx,
+							  urb->transfer_buffer,
+							  urb->actual_length);
+			else
+				dev_dbg(ctx->bus->dev,
+					"itedtv_usb_thread: !urb->actual_length\n");
+
+			if (unlikely(ret || (atomic_read_acquire(&ctx->streaming) < 1)))
+				continue;
+
+			ret = itedtv_usb_submit_urb(ctx, urb, GFP_KERNEL);
+			if (unlikely(ret)) {
+				dev_err(ctx->bus->dev,
+					"itedtv_usb_thread: usb_submit_urb() failed. (ret: %d)\n",
+					ret);
+				itedtv_usb_defer_urb(ctx, w, ret);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int itedtv_usb_start_thread(struct itedtv_usb_context *ctx)
+{
+	struct itedtv_bus *bus = ctx->bus;
+	struct task_struct *thread;
+	int cpu = READ_ONCE(bus->usb.streaming.thread.cpu);
+
+	INIT_LIST_HEAD(&ctx->done_list);
+
+	thread = kthread_create(itedtv_usb_thread, ctx,
+				"itedtv_usb/%s", dev_name(bus->dev));
+	if (IS_ERR(thread)) {
+		dev_err(bus->dev,
+			"itedtv_usb_start_thread: kthread_create() failed. (ret: %ld)\n",
+			PTR_ERR(thread));
+		return PTR_ERR(thread);
+	}
+
+	if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+		set_cpus_allowed_ptr(thread, cpumask_of(cpu));
+
+	if (READ_ONCE(bus->usb.streaming.thread.fifo)) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+		sched_set_fifo(thread);
+#else
+		struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+
+		sched_setscheduler(thread, SCHED_FIFO, &param);
+#endif
+	} else {
+		set_user_nice(thread, clamp(READ_ONCE(bus->usb.streaming.thread.nice),
+					    MIN_NICE, MAX_NICE));
+	}
+
+	ctx->thread = thread;
+	ctx->use_thread = true;
+	wake_up_process(thread);
+
+	return 0;
+}
+
+static void itedtv_usb_stop_thread(struct itedtv_usb_context *ctx)
+{
+	/* the URBs completed from now on are left in done_list */
+	if (ctx->thread) {
+		kthread_stop(ctx->thread);
+		ctx->thread = NULL;
+	}
+}
+#endif
+
 static void itedtv_usb_complete(struct urb *urb)
 {
 #ifndef ITEDTV_BUS_USE_WORKQUEUE
@@ -154,14 +573,41 @@ static void itedtv_usb_complete(struct urb *urb)
 #endif
 	struct itedtv_usb_work *w = urb->context;
 	struct itedtv_usb_context *ctx = w->ctx;
+#ifdef __linux__
+	u32 in_flight = atomic_dec_return(&ctx->in_flight);
+#endif
 
 	if (unlikely(urb->status)) {
 		dev_dbg(ctx->bus->dev,
 			"itedtv_usb_complete: status: %d\n",
 			urb->status);
+#ifdef __linux__
+		itedtv_usb_defer_urb(ctx, w, urb->status);
+#endif
 		return;
 	}
 
+#ifdef __linux__
+	trace_itedtv_usb_complete(ctx->bus->usb.dev, urb->actual_length,
+				  in_flight);
+
+	/* the URB has recovered, if it had failed */
+	w->recover_delay = ITEDTV_USB_RECOVER_MIN_DELAY;
+
+	itedtv_usb_update_stats(ctx, urb, in_flight);
+
+	if (ctx->use_thread) {
+		unsigned long flags;
+
+		spin_lock_irqsave(&ctx->done_lock, flags);
+		list_add_tail(&w->list, &ctx->done_list);
+		spin_unlock_irqrestore(&ctx->done_lock, flags);
+
+		wake_up(&ctx->done_wait);
+		return;
+	}
+#endif
+
 #ifdef ITEDTV_BUS_USE_WORKQUEUE
 	if (unlikely(!queue_work(ctx->wq, &w->work)))
 		dev_err(ctx->bus->dev,
@@ -178,11 +624,13 @@ static void itedtv_usb_complete(struct urb *urb)
 	if (unlikely(ret || (atomic_read_acquire(&ctx->streaming) < 1)))
 		return;
 
-	ret = usb_submit_urb(urb, GFP_ATOMIC);
-	if (unlikely(ret))
+	ret = itedtv_usb_submit_urb(ctx, urb, GFP_ATOMIC);
+	if (unlikely(ret)) {
 		dev_err(ctx->bus->dev,
 			"itedtv_usb_complete: usb_submit_urb() failed. (ret: %d)\n",
 			ret);
+		itedtv_usb_defer_urb(ctx, w, ret);
+	}
 #endif
 
 	return;
@@ -385,6 +833,16 @@ static void itedtv_usb_free_urb_buffers(struct itedtv_usb_context *ctx,
 
 static void itedtv_usb_clean_context(struct itedtv_usb_context *ctx, bool free_works)
 {
+#ifdef __linux__
+	itedtv_usb_stop_thread(ctx);
+	ctx->use_thread = false;
+	INIT_LIST_HEAD(&ctx->done_list);
+
+	cancel_delayed_work_sync(&ctx->recover_work);
+	INIT_LIST_HEAD(&ctx->failed_list);
+	ctx->halted = false;
+#endif
+
 #ifdef ITEDTV_BUS_USE_WORKQUEUE
 	if (ctx->wq)
 		destroy_workqueue(ctx->wq);
@@ -427,10 +885,26 @@ static int itedtv_usb_start_streaming(struct itedtv_bus *bus,
 	ctx->stream_handler = stream_handler;
 	ctx->ctx = context;
 
-	buf_size = bus->usb.streaming.urb_buffer_size;
-	num = bus->usb.streaming.urb_num;
+	buf_size = READ_ONCE(bus->usb.streaming.urb_buffer_size);
+	num = READ_ONCE(bus->usb.streaming.urb_num);
 	ctx->no_dma = bus->usb.streaming.no_dma;
 
+#ifdef __linux__
+	/* urb_max_packets may not fit the transfers */
+	if (!itedtv_bus_usb_urb_size_valid(bus, buf_size)) {
+		u32 step = 188 * itedtv_usb_packets_step(bus);
+		u32 size = max_t(u32, rounddown(buf_size, step), step);
+
+		dev_warn(bus->dev,
+			 "itedtv_usb_start_streaming: the URB size %u doesn't fit the transfers, using %u.\n",
+			 buf_size, size);
+		buf_size = size;
+	}
+
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	atomic_set(&ctx->in_flight, 0);
+#endif
+
 	if (ctx->works && num != ctx->num_works) {
 		itedtv_usb_free_urb_buffers(ctx, true);
 		kfree(ctx->works);
@@ -462,14 +936,31 @@ static int itedtv_usb_start_streaming(struct itedtv_bus *bus,
 	}
 #endif
 
+#ifdef __linux__
+	if (READ_ONCE(bus->usb.streaming.thread.enable)) {
+		ret = itedtv_usb_start_thread(ctx);
+		if (ret)
+			goto fail;
+	}
+#endif
+
 	usb_reset_endpoint(bus->usb.dev, 0x84);
 	atomic_xchg(&ctx->streaming, 1);
 
 	num = ctx->num_urb;
 	works = ctx->works;
 
+#ifdef __linux__
+	spin_lock_irq(&ctx->done_lock);
+	ctx->counters.in_flight_min = num;
+	spin_unlock_irq(&ctx->done_lock);
+#endif
+
 	for (i = 0; i < num; i++) {
-		ret = usb_submit_urb(works[i].urb, GFP_KERNEL);
+#ifdef __linux__
+		works[i].recover_delay = ITEDTV_USB_RECOVER_MIN_DELAY;
+#endif
+		ret = itedtv_usb_submit_urb(ctx, works[i].urb, GFP_KERNEL);
 		if (ret) {
 			u32 j;
 
@@ -524,6 +1015,11 @@ static int itedtv_usb_stop_streaming(struct itedtv_bus *bus)
 		flush_workqueue(ctx->wq);
 #endif
 
+#ifdef __linux__
+	itedtv_usb_stop_thread(ctx);
+	cancel_delayed_work_sync(&ctx->recover_work);
+#endif
+
 	if (ctx->works) {
 		u32 num = ctx->num_urb;
 		struct itedtv_usb_work *works = ctx->works;
@@ -532,6 +1028,11 @@ static int itedtv_usb_stop_streaming(struct itedtv_bus *bus)
 			usb_kill_urb(works[i].urb);
 	}
 
+#ifdef __linux__
+	if (READ_ONCE(bus->usb.streaming.auto_tune))
+		itedtv_usb_auto_tune(ctx);
+#endif
+
 	itedtv_usb_clean_context(ctx, false);
 
 	mutex_unlock(&ctx->lock);
@@ -581,6 +1082,18 @@ int itedtv_bus_init(struct itedtv_bus *bus)
 		ctx->num_works = 0;
 		ctx->works = NULL;
 		atomic_set(&ctx->streaming, 0);
+#ifdef __linux__
+		ctx->use_thread = false;
+		ctx->thread = NULL;
+		spin_lock_init(&ctx->done_lock);
+		INIT_LIST_HEAD(&ctx->done_list);
+		init_waitqueue_head(&ctx->done_wait);
+		INIT_LIST_HEAD(&ctx->failed_list);
+		ctx->halted = false;
+		INIT_DELAYED_WORK(&ctx->recover_work, itedtv_usb_recover_work);
+		atomic_set(&ctx->in_flight, 0);
+		memset(&ctx->counters, 0, sizeof(ctx->counters));
+#endif
 
 		bus->usb.priv = ctx;
 
@@ -597,6 +1110,12 @@ int itedtv_bus_init(struct itedtv_bus *bus)
 		break;
 	}
 
+#ifdef ITEDTV_BUS_USE_EMU
+	case ITEDTV_BUS_EMU:
+		ret = itedtv_emu_init(bus);
+		break;
+#endif
+
 	default:
 		ret = -EINVAL;
 		break;
@@ -605,6 +1124,48 @@ int itedtv_bus_init(struct itedtv_bus *bus)
 	return ret;
 }
 
+#ifdef __linux__
+int itedtv_bus_get_stats(struct itedtv_bus *bus, struct itedtv_bus_stats *stats)
+{
+	struct itedtv_usb_context *ctx;
+
+	if (!bus || !stats || bus->type != ITEDTV_BUS_USB)
+		return -EINVAL;
+
+	ctx = bus->usb.priv;
+	if (!ctx)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->done_lock);
+	*stats = ctx->counters;
+	spin_unlock_irq(&ctx->done_lock);
+
+	stats->urb_num = ctx->num_urb;
+	stats->in_flight = atomic_read(&ctx->in_flight);
+
+	return 0;
+}
+
+/*
+ * A bulk-in URB must end on a max packet boundary, or hold a whole device
+ * transfer which ends with a short packet. Otherwise the last packet doesn't
+ * fit in it and the URB completes with -EOVERFLOW.
+ */
+bool itedtv_bus_usb_urb_size_valid(struct itedtv_bus *bus, u32 size)
+{
+	u32 xfer_size = bus->usb.streaming.xfer_size;
+
+	if (!size || size % 188)
+		return false;
+
+	if (!(size % bus->usb.max_bulk_size))
+		return true;
+
+	return (xfer_size && (xfer_size % bus->usb.max_bulk_size) &&
+		size >= xfer_size);
+}
+#endif
+
 int itedtv_bus_term(struct itedtv_bus *bus)
 {
 	int ret = 0;
@@ -634,6 +1195,12 @@ int itedtv_bus_term(struct itedtv_bus *bus)
 		break;
 	}
 
+#ifdef ITEDTV_BUS_USE_EMU
+	case ITEDTV_BUS_EMU:
+		itedtv_emu_term(bus);
+		break;
+#endif
+
 	default:
 		break;
 	}
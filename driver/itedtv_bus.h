@@ -19,6 +19,7 @@
 enum itedtv_bus_type {
 	ITEDTV_BUS_NONE = 0,
 	ITEDTV_BUS_USB,
+	ITEDTV_BUS_EMU,		// software emulator, for Linux
 };
 
 typedef int (*itedtv_bus_stream_handler_t)(void *context, void *buf, u32 len);
@@ -48,20 +49,56 @@ struct itedtv_bus {
 			struct {
 				u32 urb_buffer_size;
 				u32 urb_num;
+				u32 xfer_size;	// transfer size of the device, for Linux
+				bool auto_tune;	// for Linux
 				bool no_dma;	// for Linux
+				struct {
+					bool enable;
+					int cpu;	// -1: any
+					int nice;
+					bool fifo;
+				} thread;	// for Linux
 				bool no_raw_io;	// for Windows(WinUSB)
 			} streaming;
 			void *priv;
 		} usb;
+		struct {
+			const char *capture;	// TS file to replay
+			u32 bitrate;		// in bits per second, 0: unlimited
+			u32 chunk_size;		// bytes per stream handler call
+			void *priv;
+		} emu;
 	};
 	struct itedtv_bus_operations ops;
 };
 
+#ifdef __linux__
+#define ITEDTV_BUS_FILL_BUCKETS		8	// actual_length, in 1/8 of the buffer
+#define ITEDTV_BUS_INTERVAL_BUCKETS	20	// completion interval, log2 usecs
+
+struct itedtv_bus_stats {
+	u64 urb_errors;
+	u64 urb_resubmits;
+	u64 endpoint_resets;
+	int last_error;
+	u64 submit_errors;
+	u32 urb_num;
+	u32 in_flight;
+	u32 in_flight_min;	// since streaming started
+	u64 fill_hist[ITEDTV_BUS_FILL_BUCKETS];
+	u64 interval_hist[ITEDTV_BUS_INTERVAL_BUCKETS];
+};
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 int itedtv_bus_init(struct itedtv_bus *bus);
 int itedtv_bus_term(struct itedtv_bus *bus);
+#ifdef __linux__
+int itedtv_bus_get_stats(struct itedtv_bus *bus, struct itedtv_bus_stats *stats);
+bool itedtv_bus_usb_urb_size_valid(struct itedtv_bus *bus, u32 size);
+#endif
 #ifdef __cplusplus
 }
 #endif
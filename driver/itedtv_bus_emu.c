@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * ITE IT930x bus emulator (itedtv_bus_emu.c)
+ *
+ * Answers the control messages of the IT930x firmware from a register file
+ * held in memory and replays a TS capture file as the stream.
+ * The tuners and demodulators behind the I2C buses are not emulated.
+ */
+
+#include "print_format.h"
+#include "itedtv_bus_emu.h"
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/version.h>
+
+#include "it930x.h"
+
+#define ITEDTV_EMU_MAX_REGS	128
+#define ITEDTV_EMU_FW_VERSION	0x01020304
+#define ITEDTV_EMU_RESP_SIZE	256
+/* length, sequence number and status, then the checksum */
+#define ITEDTV_EMU_MAX_DATA_LEN	(ITEDTV_EMU_RESP_SIZE - 3 - 2)
+
+struct itedtv_emu_reg {
+	u32 reg;
+	u8 val;
+};
+
+struct itedtv_emu_context {
+	struct mutex lock;
+	struct itedtv_bus *bus;
+	itedtv_bus_stream_handler_t stream_handler;
+	void *ctx;
+	struct task_struct *thread;
+	struct file *file;
+	u8 *buf;
+	u32 chunk_size;
+	u32 bitrate;
+	int num_regs;
+	struct itedtv_emu_reg regs[ITEDTV_EMU_MAX_REGS];
+	u8 resp[ITEDTV_EMU_RESP_SIZE];
+	int resp_len;
+};
+
+static struct itedtv_emu_reg *itedtv_emu_find_reg(struct itedtv_emu_context *ctx,
+						  u32 reg, bool create)
+{
+	int i;
+
+	for (i = 0; i < ctx->num_regs; i++) {
+		if (ctx->regs[i].reg == reg)
+			return &ctx->regs[i];
+	}
+
+	if (!create || ctx->num_regs >= ITEDTV_EMU_MAX_REGS)
+		return NULL;
+
+	ctx->regs[ctx->num_regs].reg = reg;
+	ctx->regs[ctx->num_regs].val = 0;
+
+	return &ctx->regs[ctx->num_regs++];
+}
+
+static int itedtv_emu_ctrl_tx(struct itedtv_bus *bus, void *buf, int len)
+{
+	struct itedtv_emu_context *ctx = bus->emu.priv;
+	const u8 *b = buf, *p;
+	u8 *resp = ctx->resp, *data = &resp[3];
+	u16 cmd, csum;
+	u32 reg;
+	int plen, dlen = 0, i;
+	u8 status = 0;
+
+	if (len < 6 || b[0] != len - 1)
+		return -EINVAL;
+
+	csum = it930x_calc_checksum(&b[1], (size_t)len - 1 - 2);
+	if (csum != ((b[len - 2] << 8) | b[len - 1])) {
+		dev_dbg(bus->dev,
+			"itedtv_emu_ctrl_tx: checksum is incorrect. (0x%04x)\n",
+			csum);
+		return -EIO;
+	}
+
+	cmd = (b[1] << 8) | b[2];
+	p = &b[4];
+	plen = len - 4 - 2;
+
+	mutex_lock(&ctx->lock);
+
+	switch (cmd) {
+	case IT930X_CMD_REG_READ:
+	case IT930X_CMD_REG_WRITE:
+	{
+		struct itedtv_emu_reg *r;
+
+		if (plen < 6 || !p[0] ||
+		    (cmd == IT930X_CMD_REG_READ && p[0] > ITEDTV_EMU_MAX_DATA_LEN) ||
+		    (cmd == IT930X_CMD_REG_WRITE && plen < 6 + p[0])) {
+			status = 1;
+			break;
+		}
+
+		reg = (p[2] << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+
+		for (i = 0; i < p[0]; i++) {
+			r = itedtv_emu_find_reg(ctx, reg + i,
+						(cmd == IT930X_CMD_REG_WRITE));
+
+			if (cmd == IT930X_CMD_REG_WRITE) {
+				if (r)
+					r->val = p[6 + i];
+			} else {
+				data[i] = (r) ? r->val : 0;
+			}
+		}
+
+		if (cmd == IT930X_CMD_REG_READ)
+			dlen = p[0];
+
+		break;
+	}
+
+	case IT930X_CMD_QUERYINFO:
+		data[0] = (ITEDTV_EMU_FW_VERSION >> 24) & 0xff;
+		data[1] = (ITEDTV_EMU_FW_VERSION >> 16) & 0xff;
+		data[2] = (ITEDTV_EMU_FW_VERSION >> 8) & 0xff;
+		data[3] = ITEDTV_EMU_FW_VERSION & 0xff;
+		dlen = 4;
+		break;
+
+	case IT930X_CMD_I2C_READ:
+		if (plen < 3 || !p[0] || p[0] > ITEDTV_EMU_MAX_DATA_LEN) {
+			status = 1;
+			break;
+		}
+
+		memset(data, 0, p[0]);
+		dlen = p[0];
+		break;
+
+	case IT930X_CMD_BOOT:
+	case IT930X_CMD_FW_SCATTER_WRITE:
+	case IT930X_CMD_I2C_WRITE:
+		break;
+
+	default:
+		dev_dbg(bus->dev,
+			"itedtv_emu_ctrl_tx: unknown command. (cmd: 0x%04x)\n",
+			cmd);
+		status = 1;
+		break;
+	}
+
+	ctx->resp_len = 3 + dlen + 2;
+
+	resp[0] = ctx->resp_len - 1;
+	resp[1] = b[3];
+	resp[2] = status;
+
+	csum = it930x_calc_checksum(&resp[1], (size_t)ctx->resp_len - 1 - 2);
+	resp[ctx->resp_len - 2] = ((csum >> 8) & 0xff);
+	resp[ctx->resp_len - 1] = (csum & 0xff);
+
+	mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+static int itedtv_emu_ctrl_rx(struct itedtv_bus *bus, void *buf, int *len)
+{
+	struct itedtv_emu_context *ctx = bus->emu.priv;
+	int ret = 0;
+
+	if (!buf || !len || !*len)
+		return -EINVAL;
+
+	mutex_lock(&ctx->lock);
+
+	if (!ctx->resp_len) {
+		ret = -EIO;
+	} else {
+		*len = min(*len, ctx->resp_len);
+		memcpy(buf, ctx->resp, *len);
+		ctx->resp_len = 0;
+	}
+
+	mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+static int itedtv_emu_stream_rx(struct itedtv_bus *bus,
+				void *buf, int *len,
+				int timeout)
+{
+	return -EOPNOTSUPP;
+}
+
+static ssize_t itedtv_emu_read_capture(struct itedtv_emu_context *ctx,
+				       loff_t *pos)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0)
+	return kernel_read(ctx->file, ctx->buf, ctx->chunk_size, pos);
+#else
+	int ret;
+
+	ret = kernel_read(ctx->file, *pos, ctx->buf, ctx->chunk_size);
+	if (ret > 0)
+		*pos += ret;
+
+	return ret;
+#endif
+}
+
+static int itedtv_emu_thread(void *param)
+{
+	struct itedtv_emu_context *ctx = param;
+	struct itedtv_bus *bus = ctx->bus;
+	loff_t pos = 0;
+	ktime_t next = ktime_get();
+	ssize_t len;
+
+	while (!kthread_should_stop()) {
+		len = itedtv_emu_read_capture(ctx, &pos);
+		if (len < 0) {
+			dev_err(bus->dev,
+				"itedtv_emu_thread: kernel_read() failed. (ret: %zd)\n",
+				len);
+			break;
+		} else if (!len) {
+			if (!pos) {
+				dev_err(bus->dev,
+					"itedtv_emu_thread: the capture file is empty.\n");
+				break;
+			}
+
+			/* loop the capture */
+			pos = 0;
+			continue;
+		}
+
+		ctx->stream_handler(ctx->ctx, ctx->buf, (u32)len);
+
+		if (!ctx->bitrate) {
+			cond_resched();
+			continue;
+		}
+
+		next = ktime_add_ns(next, div_u64((u64)len * 8 * NSEC_PER_SEC,
+						  ctx->bitrate));
+
+		/* don't try to catch up after a long stall */
+		if (ktime_before(ktime_add_ms(next, 1000), ktime_get()))
+			next = ktime_get();
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_hrtimeout_range(&next, 100 * NSEC_PER_USEC,
+						 HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	/* wait for kthread_stop() */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static int itedtv_emu_start_streaming(struct itedtv_bus *bus,
+				      itedtv_bus_stream_handler_t stream_handler,
+				      void *context)
+{
+	int ret = 0;
+	struct itedtv_emu_context *ctx = bus->emu.priv;
+	struct file *file;
+	struct task_struct *thread;
+
+	if (!stream_handler)
+		return -EINVAL;
+
+	if (!bus->emu.capture || !bus->emu.capture[0]) {
+		dev_err(bus->dev,
+			"itedtv_emu_start_streaming: no capture file.\n");
+		return -ENOENT;
+	}
+
+	mutex_lock(&ctx->lock);
+
+	if (ctx->thread) {
+		ret = -EALREADY;
+		goto exit;
+	}
+
+	ctx->chunk_size = (bus->emu.chunk_size) ? bus->emu.chunk_size
+						: 188 * 816;
+	ctx->bitrate = bus->emu.bitrate;
+
+	ctx->buf = kmalloc(ctx->chunk_size, GFP_KERNEL);
+	if (!ctx->buf) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	file = filp_open(bus->emu.capture, O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		dev_err(bus->dev,
+			"itedtv_emu_start_streaming: filp_open(\"%s\") failed. (ret: %d)\n",
+			bus->emu.capture, ret);
+		goto fail_file;
+	}
+
+	ctx->file = file;
+	ctx->stream_handler = stream_handler;
+	ctx->ctx = context;
+
+	thread = kthread_run(itedtv_emu_thread, ctx,
+			     "itedtv_emu/%s", dev_name(bus->dev));
+	if (IS_ERR(thread)) {
+		ret = PTR_ERR(thread);
+		dev_err(bus->dev,
+			"itedtv_emu_start_streaming: kthread_run() failed. (ret: %d)\n",
+			ret);
+		goto fail_thread;
+	}
+
+	ctx->thread = thread;
+
+	mutex_unlock(&ctx->lock);
+
+	return 0;
+
+fail_thread:
+	filp_close(file, NULL);
+	ctx->file = NULL;
+
+fail_file:
+	kfree(ctx->buf);
+	ctx->buf = NULL;
+
+exit:
+	mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+static int itedtv_emu_stop_streaming(struct itedtv_bus *bus)
+{
+	struct itedtv_emu_context *ctx = bus->emu.priv;
+
+	mutex_lock(&ctx->lock);
+
+	if (ctx->thread) {
+		kthread_stop(ctx->thread);
+		ctx->thread = NULL;
+
+		filp_close(ctx->file, NULL);
+		ctx->file = NULL;
+
+		kfree(ctx->buf);
+		ctx->buf = NULL;
+	}
+
+	ctx->stream_handler = NULL;
+	ctx->ctx = NULL;
+
+	mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+int itedtv_emu_init(struct itedtv_bus *bus)
+{
+	struct itedtv_emu_context *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	mutex_init(&ctx->lock);
+	ctx->bus = bus;
+
+	bus->emu.priv = ctx;
+
+	bus->ops.ctrl_tx = itedtv_emu_ctrl_tx;
+	bus->ops.ctrl_rx = itedtv_emu_ctrl_rx;
+	bus->ops.stream_rx = itedtv_emu_stream_rx;
+	bus->ops.start_streaming = itedtv_emu_start_streaming;
+	bus->ops.stop_streaming = itedtv_emu_stop_streaming;
+
+	return 0;
+}
+
+int itedtv_emu_term(struct itedtv_bus *bus)
+{
+	struct itedtv_emu_context *ctx = bus->emu.priv;
+
+	if (!ctx)
+		return 0;
+
+	itedtv_emu_stop_streaming(bus);
+
+	mutex_destroy(&ctx->lock);
+	kfree(ctx);
+
+	bus->emu.priv = NULL;
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * ITE IT930x bus emulator definitions (itedtv_bus_emu.h)
+ */
+
+#ifndef __ITEDTV_BUS_EMU_H__
+#define __ITEDTV_BUS_EMU_H__
+
+#include "itedtv_bus.h"
+
+int itedtv_emu_init(struct itedtv_bus *bus);
+int itedtv_emu_term(struct itedtv_bus *bus);
+
+#endif
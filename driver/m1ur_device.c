@@ -14,14 +14,11 @@
 
 #include "px4_device_params.h"
 #include "firmware.h"
-
-#define M1UR_DEVICE_TS_SYNC_COUNT	4
-#define M1UR_DEVICE_TS_SYNC_SIZE	(188 * M1UR_DEVICE_TS_SYNC_COUNT)
+#include "ts_demux.h"
 
 struct m1ur_stream_context {
 	struct ptx_chrdev *chrdev;
-	u8 remain_buf[M1UR_DEVICE_TS_SYNC_SIZE];
-	size_t remain_len;
+	struct ts_demux demux;
 };
 
 static void m1ur_device_release(struct kref *kref);
@@ -110,86 +107,18 @@ static int m1ur_backend_term(struct m1ur_device *m1ur)
 	return 0;
 }
 
-static void m1ur_device_stream_process(struct ptx_chrdev *chrdev,
-					   u8 **buf, u32 *len)
+static void m1ur_device_stream_put(void *context, int id, u8 *buf, u32 len)
 {
-	u8 *p = *buf;
-	u32 remain = *len;
-
-	while (likely(remain)) {
-		u32 i = 0;
-		bool sync_remain = false;
-
-		while (true) {
-			if (likely(((i + 1) * 188) <= remain)) {
-				if (unlikely(p[i * 188] != 0x47))
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-			i++;
-		}
-
-		if (unlikely(i < M1UR_DEVICE_TS_SYNC_COUNT)) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		ptx_chrdev_put_stream(chrdev, p, 188 * i);
-
-		p += 188 * i;
-		remain -= 188 * i;
-
-		if (unlikely(sync_remain))
-			break;
-	}
-
-	*buf = p;
-	*len = remain;
+	struct m1ur_stream_context *stream_ctx = context;
 
-	return;
+	ptx_chrdev_put_stream(stream_ctx->chrdev, buf, len);
 }
 
 static int m1ur_device_stream_handler(void *context, void *buf, u32 len)
 {
 	struct m1ur_stream_context *stream_ctx = context;
-	u8 *ctx_remain_buf = stream_ctx->remain_buf;
-	u32 ctx_remain_len = stream_ctx->remain_len;
-	u8 *p = buf;
-	u32 remain = len;
-
-	if (unlikely(ctx_remain_len)) {
-		if (likely((ctx_remain_len + len) >= M1UR_DEVICE_TS_SYNC_SIZE)) {
-			u32 t = M1UR_DEVICE_TS_SYNC_SIZE - ctx_remain_len;
-
-			memcpy(ctx_remain_buf + ctx_remain_len, p, t);
-			ctx_remain_len = M1UR_DEVICE_TS_SYNC_SIZE;
-
-			m1ur_device_stream_process(stream_ctx->chrdev,
-						  &ctx_remain_buf,
-						  &ctx_remain_len);
-			if (likely(!ctx_remain_len)) {
-				p += t;
-				remain -= t;
-			}
-
-			stream_ctx->remain_len = 0;
-		} else {
-			memcpy(ctx_remain_buf + ctx_remain_len, p, len);
-			stream_ctx->remain_len += len;
-
-			return 0;
-		}
-	}
 
-	m1ur_device_stream_process(stream_ctx->chrdev, &p, &remain);
-
-	if (unlikely(remain)) {
-		memcpy(stream_ctx->remain_buf, p, remain);
-		stream_ctx->remain_len = remain;
-	}
+	ts_demux_process(&stream_ctx->demux, buf, len);
 
 	return 0;
 }
@@ -740,7 +669,7 @@ static int m1ur_chrdev_start_capture(struct ptx_chrdev *chrdev)
 	if (ret)
 		goto fail_tc;
 
-	stream_ctx->remain_len = 0;
+	ts_demux_reset(&stream_ctx->demux);
 
 	ret = itedtv_bus_start_streaming(&m1ur->it930x.bus,
 					 m1ur_device_stream_handler,
@@ -834,6 +763,18 @@ static int m1ur_chrdev_read_cnr_raw(struct ptx_chrdev *chrdev, u32 *value)
 	return ret;
 }
 
+static int m1ur_chrdev_set_pid_filter(struct ptx_chrdev *chrdev,
+				      const struct ptx_hw_pid_filter *filter)
+{
+	struct m1ur_chrdev *chrdevm1ur = chrdev->priv;
+	struct m1ur_device *m1ur = container_of(chrdevm1ur,
+						struct m1ur_device,
+						chrdevm1ur);
+
+	return it930x_apply_ptx_pid_filter(&m1ur->it930x, 0, filter,
+					   px4_device_params.discard_null_packets);
+}
+
 static struct ptx_chrdev_operations m1ur_chrdev_ops = {
 	.init = m1ur_chrdev_init,
 	.term = m1ur_chrdev_term,
@@ -846,7 +787,8 @@ static struct ptx_chrdev_operations m1ur_chrdev_ops = {
 	.set_capture = m1ur_chrdev_set_capture,
 	.read_signal_strength = NULL,
 	.read_cnr = NULL,
-	.read_cnr_raw = m1ur_chrdev_read_cnr_raw
+	.read_cnr_raw = m1ur_chrdev_read_cnr_raw,
+	.set_pid_filter = m1ur_chrdev_set_pid_filter
 };
 
 static int m1ur_device_load_config(struct m1ur_device *m1ur,
@@ -1030,6 +972,7 @@ int m1ur_device_init(struct m1ur_device *m1ur, struct device *dev,
 	chrdev_group_config.minor_base = 0;	/* unused */
 	chrdev_group_config.chrdev_num = 1;
 	chrdev_group_config.chrdev_config = &chrdev_config;
+	chrdev_group_config.stream_stats = &stream_ctx->demux.stats;
 
 	ret = ptx_chrdev_context_add_group(chrdev_ctx, dev,
 					   &chrdev_group_config, &chrdev_group);
@@ -1039,6 +982,8 @@ int m1ur_device_init(struct m1ur_device *m1ur, struct device *dev,
 	m1ur->chrdev_group = chrdev_group;
 	m1ur->chrdevm1ur.chrdev = &chrdev_group->chrdev[0];
 	stream_ctx->chrdev = &chrdev_group->chrdev[0];
+	ts_demux_init(&stream_ctx->demux, TS_DEMUX_FORMAT_PLAIN,
+		      1, m1ur_device_stream_put, stream_ctx);
 
 	atomic_set(&m1ur->available, 1);
 	return 0;
@@ -15,8 +15,25 @@
 #include <linux/sched.h>
 #include <linux/uaccess.h>
 #include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/version.h>
 
+#define CREATE_TRACE_POINTS
+#include "ptx_trace.h"
+#include "ts_demux_trace.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+#define __poll_t	unsigned int
+#define EPOLLIN		POLLIN
+#define EPOLLRDNORM	POLLRDNORM
+#define EPOLLERR	POLLERR
+#define EPOLLHUP	POLLHUP
+#endif
+
 static LIST_HEAD(ctx_list);
 static DEFINE_MUTEX(ctx_list_lock);
 
@@ -26,8 +43,46 @@ static bool ptx_chrdev_context_search_group(struct ptx_chrdev_context *chrdev_ct
 					    unsigned int minor,
 					    struct ptx_chrdev_group **chrdev_group);
 static void ptx_chrdev_group_release(struct kref *kref);
+static void ptx_chrdev_service_work(struct work_struct *work);
+static enum hrtimer_restart ptx_chrdev_latency_timer(struct hrtimer *timer);
 static void ptx_chrdev_context_release(struct kref *kref);
 
+/* chrdev->lock must be held */
+static void ptx_chrdev_update_wakeup(struct ptx_chrdev *chrdev)
+{
+	struct ptx_chrdev_file *file_ctx;
+	size_t wakeup_size = 0;
+	u64 max_latency_ns = 0;
+
+	list_for_each_entry(file_ctx, &chrdev->files, list) {
+		size_t size = (file_ctx->low_watermark) ? file_ctx->low_watermark
+							: chrdev->ringbuf_threshold_size;
+
+		if (!wakeup_size || size < wakeup_size)
+			wakeup_size = size;
+
+		if (file_ctx->max_latency_ns &&
+		    (!max_latency_ns || file_ctx->max_latency_ns < max_latency_ns))
+			max_latency_ns = file_ctx->max_latency_ns;
+	}
+
+	WRITE_ONCE(chrdev->wakeup_size,
+		   (wakeup_size) ? wakeup_size : chrdev->ringbuf_threshold_size);
+	WRITE_ONCE(chrdev->max_latency_ns, max_latency_ns);
+}
+
+/*
+ * chrdev->lock must be held
+ * The owner may read slowly or not at all, so while read-only readers are
+ * attached the oldest data is dropped rather than the incoming data.
+ */
+static void ptx_chrdev_update_overflow_policy(struct ptx_chrdev *chrdev)
+{
+	ringbuffer_set_overflow_policy(chrdev->ringbuf,
+				       (chrdev->reader_num) ? PTX_OVERFLOW_DROP_OLDEST
+							    : chrdev->overflow_policy);
+}
+
 static int ptx_chrdev_open(struct inode *inode, struct file *file)
 {
 	int ret = 0;
@@ -35,12 +90,18 @@ static int ptx_chrdev_open(struct inode *inode, struct file *file)
 	struct ptx_chrdev_context *ctx;
 	struct ptx_chrdev_group *group;
 	struct ptx_chrdev *chrdev = NULL;
+	struct ptx_chrdev_file *file_ctx;
 	struct kref *owner_kref = NULL;
 	void (*owner_kref_release)(struct kref *) = NULL;
+	bool owner;
 
 	major = imajor(inode);
 	minor = iminor(inode);
 
+	file_ctx = kzalloc(sizeof(*file_ctx), GFP_KERNEL);
+	if (!file_ctx)
+		return -ENOMEM;
+
 	mutex_lock(&ctx_list_lock);
 
 	if (!ptx_chrdev_search_context(major, &ctx)) {
@@ -77,22 +138,44 @@ static int ptx_chrdev_open(struct inode *inode, struct file *file)
 
 	chrdev = &group->chrdev[minor - group->minor_base];
 
-	ret = (atomic_cmpxchg(&chrdev->open, 0, 1)) ? -EALREADY : 0;
-	if (ret) {
-		mutex_unlock(&group->lock);
-		goto fail_group;
-	}
+	owner = !atomic_cmpxchg(&chrdev->open, 0, 1);
 
 	mutex_lock(&chrdev->lock);
 	mutex_unlock(&group->lock);
 
-	chrdev->current_system = PTX_UNSPECIFIED_SYSTEM;
+	if (owner) {
+		chrdev->current_system = PTX_UNSPECIFIED_SYSTEM;
+		chrdev->shared_read = false;
+		WRITE_ONCE(chrdev->service_enabled, false);
+		WRITE_ONCE(chrdev->pid_filter_enabled, false);
+		chrdev->overflow_policy = PTX_OVERFLOW_DROP_NEWEST;
+		ptx_chrdev_update_overflow_policy(chrdev);
+
+		if (chrdev->ops && chrdev->ops->open)
+			ret = chrdev->ops->open(chrdev);
+	} else if (!chrdev->shared_read || (file->f_mode & FMODE_WRITE)) {
+		ret = -EALREADY;
+	} else {
+		/* join the owner's stream as a read-only reader */
+		file_ctx->owner_gen = chrdev->owner_gen;
+		file_ctx->pos = ringbuffer_snoop_pos(chrdev->ringbuf);
+		chrdev->reader_num++;
+		ptx_chrdev_update_overflow_policy(chrdev);
+
+		/* the data is stored for the readers even if the owner never reads */
+		if (chrdev->streaming)
+			ringbuffer_ready_read(chrdev->ringbuf);
+	}
 
-	if (chrdev->ops && chrdev->ops->open)
-		ret = chrdev->ops->open(chrdev);
+	if (!ret) {
+		file_ctx->chrdev = chrdev;
+		file_ctx->owner = owner;
+		file_ctx->flush_gen = READ_ONCE(chrdev->flush_gen);
+		file->private_data = file_ctx;
 
-	if (!ret)
-		file->private_data = chrdev;
+		list_add_tail(&file_ctx->list, &chrdev->files);
+		ptx_chrdev_update_wakeup(chrdev);
+	}
 
 	mutex_unlock(&chrdev->lock);
 
@@ -102,7 +185,8 @@ static int ptx_chrdev_open(struct inode *inode, struct file *file)
 	return 0;
 
 fail_chrdev:
-	atomic_dec_return(&chrdev->open);
+	if (owner)
+		atomic_dec_return(&chrdev->open);
 
 fail_group:
 	kref_put(&group->kref, ptx_chrdev_group_release);
@@ -114,59 +198,278 @@ fail_ctx:
 	kref_put(&ctx->kref, ptx_chrdev_context_release);
 
 fail:
+	kfree(file_ctx);
 	return ret;
 }
 
-static ssize_t ptx_chrdev_read(struct file *file,
-			       char __user *buf, size_t count, loff_t *ppos)
+static bool ptx_chrdev_file_is_flushed(struct ptx_chrdev_file *file_ctx)
+{
+	/* the latency timer has expired since the last read */
+	return READ_ONCE(file_ctx->chrdev->flush_gen) != file_ctx->flush_gen;
+}
+
+static bool ptx_chrdev_file_is_readable(struct ptx_chrdev_file *file_ctx)
+{
+	struct ringbuffer *ringbuf = file_ctx->chrdev->ringbuf;
+	u64 size;
+
+	size = (file_ctx->owner) ? ringbuffer_readable_size(ringbuf)
+				 : ringbuffer_snoopable_size(ringbuf, file_ctx->pos);
+	if (!size)
+		return false;
+
+	return likely(size >= file_ctx->low_watermark) ||
+	       ptx_chrdev_file_is_flushed(file_ctx);
+}
+
+static bool ptx_chrdev_file_is_detached(struct ptx_chrdev_file *file_ctx)
+{
+	/* the owner that the reader joined has gone */
+	return !file_ctx->owner &&
+	       READ_ONCE(file_ctx->chrdev->owner_gen) != file_ctx->owner_gen;
+}
+
+static u32 ptx_chrdev_arrival_prefix(void *context, u64 pos)
+{
+	struct ptx_chrdev *chrdev = context;
+	u32 idx;
+
+	div_u64_rem(div_u64(pos, 188), chrdev->arrival_num, &idx);
+
+	/* copy_permission_indicator is always 0 */
+	return READ_ONCE(chrdev->arrival[idx]);
+}
+
+static u32 ptx_chrdev_arrival_time_now(void)
+{
+	/* arrival_time_stamp of BDAV/M2TS: 27 MHz, 30 bits */
+	return (u32)div_u64(ktime_get_ns() * 27, 1000) & 0x3fffffff;
+}
+
+/* how long the packet at pos has waited since it was put into the ring */
+static void ptx_chrdev_sample_latency(struct ptx_chrdev *chrdev, u64 pos)
+{
+	u32 idx, latency;
+	unsigned int bucket;
+
+	div_u64_rem(div_u64(pos, 188), chrdev->arrival_num, &idx);
+
+	latency = (ptx_chrdev_arrival_time_now() -
+		   READ_ONCE(chrdev->arrival[idx])) & 0x3fffffff;
+	latency /= 27;
+
+	bucket = (latency) ? min(ilog2(latency) + 1,
+				 PTX_CHRDEV_LATENCY_BUCKETS - 1) : 0;
+	atomic64_inc(&chrdev->latency_hist[bucket]);
+}
+
+static ssize_t ptx_chrdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
 	int ret = 0;
-	struct ptx_chrdev *chrdev = file->private_data;
+	struct file *file = iocb->ki_filp;
+	struct ptx_chrdev_file *file_ctx = file->private_data;
+	struct ptx_chrdev *chrdev = file_ctx->chrdev;
 	struct ptx_chrdev_group *group = chrdev->parent;
-	u8 __user *p = buf;
+	bool nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	size_t count = iov_iter_count(to);
 	size_t remain = count;
+	unsigned int flush_gen;
+	u64 wait_start, wait_ns = 0;
+	ssize_t result;
+	bool latency = smp_load_acquire(&chrdev->latency_enabled);
 
 	if (unlikely(!atomic_read_acquire(&group->available)))
 		return -EIO;
 
-	ringbuffer_ready_read(chrdev->ringbuf);
+	if (unlikely(file_ctx->m2ts && count < 4 + 188))
+		return -EINVAL;
+
+	if (file_ctx->owner)
+		ringbuffer_ready_read(chrdev->ringbuf);
 
 	while (likely(remain)) {
 		size_t len;
+		u64 pos;
+
+		if (nonblock &&
+		    !ptx_chrdev_file_is_readable(file_ctx) &&
+		    likely(ringbuffer_is_running(chrdev->ringbuf)) &&
+		    likely(!ptx_chrdev_file_is_detached(file_ctx))) {
+			if (remain == count)
+				ret = -EAGAIN;
+
+			break;
+		}
+
+		wait_start = (trace_ptx_chrdev_read_enabled()) ? ktime_get_ns() : 0;
 
 		if (wait_event_interruptible(chrdev->ringbuf_wait,
-					     likely(ringbuffer_is_readable(chrdev->ringbuf)) ||
+					     likely(ptx_chrdev_file_is_readable(file_ctx)) ||
 					     unlikely(!ringbuffer_is_running(chrdev->ringbuf)) ||
-					     unlikely(!atomic_read(&group->available)))) {
+					     unlikely(!atomic_read(&group->available)) ||
+					     unlikely(ptx_chrdev_file_is_detached(file_ctx)))) {
 			if (unlikely(remain == count))
 				ret = -EINTR;
 
 			break;
 		}
 
+		if (wait_start)
+			wait_ns += ktime_get_ns() - wait_start;
+
+		flush_gen = READ_ONCE(chrdev->flush_gen);
+		pos = (file_ctx->owner) ? ringbuffer_read_pos(chrdev->ringbuf)
+					: file_ctx->pos;
+
 		len = remain;
-		ret = ringbuffer_read_user(chrdev->ringbuf, p, &len);
+		if (unlikely(file_ctx->m2ts)) {
+			if (likely(file_ctx->owner)) {
+				ret = ringbuffer_read_prefixed_iter(chrdev->ringbuf,
+								    to, &len,
+								    ptx_chrdev_arrival_prefix,
+								    chrdev);
+			} else {
+				if (unlikely(ptx_chrdev_file_is_detached(file_ctx)))
+					break;
+
+				ret = ringbuffer_snoop_prefixed_iter(chrdev->ringbuf,
+								     &file_ctx->pos,
+								     to, &len,
+								     &file_ctx->lost_bytes,
+								     ptx_chrdev_arrival_prefix,
+								     chrdev);
+			}
+
+			/*
+			 * only realigned to a packet boundary, wait for a packet
+			 * unless nothing more is going to come
+			 */
+			if (unlikely(!ret && !len && remain == count) &&
+			    likely(ringbuffer_is_running(chrdev->ringbuf)) &&
+			    likely(atomic_read(&group->available)) &&
+			    likely(!ptx_chrdev_file_is_detached(file_ctx)))
+				continue;
+		} else if (likely(file_ctx->owner)) {
+			ret = ringbuffer_read_iter(chrdev->ringbuf, to, &len);
+		} else {
+			if (unlikely(ptx_chrdev_file_is_detached(file_ctx)))
+				break;
+
+			ret = ringbuffer_snoop_iter(chrdev->ringbuf,
+						    &file_ctx->pos, to, &len,
+						    &file_ctx->lost_bytes);
+		}
+
+		file_ctx->read_bytes += len;
+
 		if (unlikely(ret || !len))
 			break;
 
-		p += len;
+		/* sampled once per chunk, at its oldest packet */
+		if (unlikely(latency))
+			ptx_chrdev_sample_latency(chrdev, pos);
+
 		remain -= len;
+
+		if (ptx_chrdev_file_is_flushed(file_ctx)) {
+			/* do not hold back the data any longer */
+			file_ctx->flush_gen = flush_gen;
+			break;
+		}
 	}
 
-	return likely(!ret) ? (count - remain) : ret;
+	result = likely(!ret) ? (count - remain) : ret;
+	trace_ptx_chrdev_read(chrdev, file_ctx->owner, result, wait_ns);
+
+	return result;
+}
+
+static __poll_t ptx_chrdev_poll(struct file *file, poll_table *wait)
+{
+	__poll_t mask = 0;
+	struct ptx_chrdev_file *file_ctx = file->private_data;
+	struct ptx_chrdev *chrdev = file_ctx->chrdev;
+	struct ptx_chrdev_group *group = chrdev->parent;
+
+	poll_wait(file, &chrdev->ringbuf_wait, wait);
+
+	if (unlikely(!atomic_read_acquire(&group->available)))
+		return EPOLLERR | EPOLLHUP;
+
+	/* the writer does not store anything until the owner is ready */
+	if (file_ctx->owner)
+		ringbuffer_ready_read(chrdev->ringbuf);
+
+	if (ptx_chrdev_file_is_readable(file_ctx))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	else if (!ringbuffer_is_running(chrdev->ringbuf) ||
+		 ptx_chrdev_file_is_detached(file_ctx))
+		mask |= EPOLLHUP;
+
+	return mask;
+}
+
+static int ptx_chrdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int ret = 0;
+	struct ptx_chrdev_file *file_ctx = file->private_data;
+	struct ptx_chrdev *chrdev = file_ctx->chrdev;
+	struct ptx_chrdev_group *group = chrdev->parent;
+
+	if (unlikely(!atomic_read_acquire(&group->available)))
+		return -EIO;
+
+	if (!file_ctx->owner)
+		return -EPERM;
+
+	ret = ringbuffer_mmap(chrdev->ringbuf, vma);
+	if (ret)
+		return ret;
+
+	ringbuffer_ready_read(chrdev->ringbuf);
+
+	return 0;
 }
 
 static int ptx_chrdev_release(struct inode *inode, struct file *file)
 {
 	int ret = 0;
-	struct ptx_chrdev *chrdev = file->private_data;
+	struct ptx_chrdev_file *file_ctx = file->private_data;
+	struct ptx_chrdev *chrdev = file_ctx->chrdev;
 	struct ptx_chrdev_group *group = chrdev->parent;
 	struct ptx_chrdev_context *ctx = group->parent;
 	struct kref *owner_kref = group->owner_kref;
 	void (*owner_kref_release)(struct kref *) = group->owner_kref_release;
 
+	if (file_ctx->owner) {
+		WRITE_ONCE(chrdev->service_enabled, false);
+		cancel_work_sync(&chrdev->service_work);
+	}
+
 	mutex_lock(&chrdev->lock);
 
+	list_del(&file_ctx->list);
+	ptx_chrdev_update_wakeup(chrdev);
+
+	if (file_ctx->m2ts)
+		WRITE_ONCE(chrdev->arrival_users, chrdev->arrival_users - 1);
+
+	if (!file_ctx->owner) {
+		/* the owner has already let go of a detached reader */
+		if (!ptx_chrdev_file_is_detached(file_ctx)) {
+			chrdev->reader_num--;
+			ptx_chrdev_update_overflow_policy(chrdev);
+		}
+
+		mutex_unlock(&chrdev->lock);
+		goto exit;
+	}
+
+	/* detach the readers that joined this owner */
+	chrdev->shared_read = false;
+	chrdev->owner_gen++;
+	chrdev->reader_num = 0;
+
 	if (chrdev->streaming) {
 		if (chrdev->ops && chrdev->ops->set_capture)
 			chrdev->ops->set_capture(chrdev, false);
@@ -176,12 +479,24 @@ static int ptx_chrdev_release(struct inode *inode, struct file *file)
 		chrdev->streaming = false;
 	}
 
+	hrtimer_cancel(&chrdev->latency_timer);
+
+	if (chrdev->hw_pid_filter) {
+		/* the next owner starts with the default filter */
+		chrdev->ops->set_pid_filter(chrdev, NULL);
+		chrdev->hw_pid_filter = false;
+	}
+
 	if (chrdev->ops && chrdev->ops->release)
 		ret = chrdev->ops->release(chrdev);
 
 	mutex_unlock(&chrdev->lock);
 
+	wake_up(&chrdev->ringbuf_wait);
 	atomic_dec_return(&chrdev->open);
+
+exit:
+	kfree(file_ctx);
 	kref_put(&group->kref, ptx_chrdev_group_release);
 
 	if (owner_kref)
@@ -191,16 +506,147 @@ static int ptx_chrdev_release(struct inode *inode, struct file *file)
 	return ret;
 }
 
+/*
+ * The stream handler is the only writer of the counters and of cc,
+ * so it's asked to clear them before it counts the next packets.
+ */
+static void ptx_chrdev_reset_stats(struct ptx_chrdev *chrdev)
+{
+	int i;
+
+	smp_store_release(&chrdev->stats_reset_gen, chrdev->stats_reset_gen + 1);
+
+	atomic64_set(&chrdev->wakeups, 0);
+
+	for (i = 0; i < PTX_CHRDEV_LATENCY_BUCKETS; i++)
+		atomic64_set(&chrdev->latency_hist[i], 0);
+}
+
+/* chrdev->lock must be held */
+static int ptx_chrdev_alloc_arrival(struct ptx_chrdev *chrdev)
+{
+	u32 num = ringbuffer_size(chrdev->ringbuf) / 188 + 2;
+	u32 *arrival;
+
+	if (chrdev->arrival)
+		return 0;
+
+	arrival = vzalloc(sizeof(*arrival) * num);
+	if (!arrival)
+		return -ENOMEM;
+
+	chrdev->arrival_num = num;
+	smp_store_release(&chrdev->arrival, arrival);
+
+	return 0;
+}
+
 static long ptx_chrdev_unlocked_ioctl(struct file *file,
 				      unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
-	struct ptx_chrdev *chrdev = file->private_data;
+	struct ptx_chrdev_file *file_ctx = file->private_data;
+	struct ptx_chrdev *chrdev = file_ctx->chrdev;
 	struct ptx_chrdev_group *group = chrdev->parent;
 
 	if (!atomic_read_acquire(&group->available))
 		return -EIO;
 
+	switch (cmd) {
+	case PTX_GET_READER_STATS:
+	{
+		struct ptx_reader_stats stats;
+
+		stats.read_bytes = file_ctx->read_bytes;
+		stats.lost_bytes = file_ctx->lost_bytes;
+
+		if (copy_to_user((void *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+
+		return 0;
+	}
+
+	case PTX_GET_DROP_STATS:
+	{
+		struct ptx_drop_stats stats;
+
+		ringbuffer_get_drop_stats(chrdev->ringbuf,
+					  &stats.packets, &stats.bytes);
+
+		if (copy_to_user((void *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+
+		return 0;
+	}
+
+	case PTX_SET_WAKEUP_PARAMS:
+	{
+		struct ptx_wakeup_params params;
+
+		if (copy_from_user(&params, (void *)arg, sizeof(params)))
+			return -EFAULT;
+
+		if (params.low_watermark > ringbuffer_size(chrdev->ringbuf) / 2)
+			return -EINVAL;
+
+		mutex_lock(&chrdev->lock);
+
+		file_ctx->low_watermark = params.low_watermark;
+		file_ctx->max_latency_ns = (u64)params.max_latency_us * NSEC_PER_USEC;
+		ptx_chrdev_update_wakeup(chrdev);
+
+		mutex_unlock(&chrdev->lock);
+
+		/* let the waiters reevaluate with the new parameters */
+		wake_up(&chrdev->ringbuf_wait);
+		return 0;
+	}
+
+	case PTX_SET_M2TS_MODE:
+	{
+		bool enable = !!arg;
+
+		mutex_lock(&chrdev->lock);
+
+		if (enable && ptx_chrdev_alloc_arrival(chrdev)) {
+			mutex_unlock(&chrdev->lock);
+			return -ENOMEM;
+		}
+
+		if (enable != file_ctx->m2ts) {
+			file_ctx->m2ts = enable;
+			smp_store_release(&chrdev->arrival_users,
+					  chrdev->arrival_users + ((enable) ? 1 : -1));
+		}
+
+		mutex_unlock(&chrdev->lock);
+		return 0;
+	}
+
+	case PTX_GET_CNR:
+		break;
+
+	default:
+		/* readers are not allowed to control the tuner */
+		if (!file_ctx->owner)
+			return -EPERM;
+
+		break;
+	}
+
+	/* called once per chunk by mmap readers, so keep it off the lock */
+	if (cmd == PTX_MMAP_CONSUME) {
+		file_ctx->flush_gen = READ_ONCE(chrdev->flush_gen);
+		return ringbuffer_consume(chrdev->ringbuf, arg);
+	}
+
+	/* the service work takes the lock, so stop it beforehand */
+	if (cmd == PTX_SET_PID_FILTER || cmd == PTX_CLEAR_PID_FILTER ||
+	    cmd == PTX_SET_SERVICE_FILTER) {
+		WRITE_ONCE(chrdev->service_enabled, false);
+		cancel_work_sync(&chrdev->service_work);
+	}
+
 	mutex_lock(&chrdev->lock);
 
 	switch (cmd) {
@@ -387,9 +833,14 @@ static long ptx_chrdev_unlocked_ioctl(struct file *file,
 			ret = -ENOSYS;
 
 		if (!ret) {
+			ptx_chrdev_reset_stats(chrdev);
 			ringbuffer_reset(chrdev->ringbuf);
 			ringbuffer_start(chrdev->ringbuf);
 			chrdev->streaming = true;
+
+			/* the readers attached so far do not wait for the owner */
+			if (chrdev->reader_num)
+				ringbuffer_ready_read(chrdev->ringbuf);
 		}
 
 		break;
@@ -469,6 +920,116 @@ static long ptx_chrdev_unlocked_ioctl(struct file *file,
 
 		break;
 
+	case PTX_SET_SHARED_READ:
+		chrdev->shared_read = !!arg;
+		break;
+
+	case PTX_SET_PID_FILTER:
+	{
+		struct ptx_pid_filter *filter;
+
+		filter = memdup_user((void *)arg, sizeof(*filter));
+		if (IS_ERR(filter)) {
+			ret = PTR_ERR(filter);
+			break;
+		}
+
+		WRITE_ONCE(chrdev->service_enabled, false);
+
+		/* the stream handler may see a mix of both filters for a moment */
+		memcpy(chrdev->pid_filter, filter->map, sizeof(chrdev->pid_filter));
+		smp_store_release(&chrdev->pid_filter_enabled, true);
+
+		kfree(filter);
+		break;
+	}
+
+	case PTX_CLEAR_PID_FILTER:
+		WRITE_ONCE(chrdev->service_enabled, false);
+		WRITE_ONCE(chrdev->pid_filter_enabled, false);
+		break;
+
+	case PTX_SET_HW_PID_FILTER:
+	{
+		struct ptx_hw_pid_filter filter;
+
+		if (!chrdev->ops || !chrdev->ops->set_pid_filter) {
+			ret = -ENOSYS;
+			break;
+		}
+
+		if (copy_from_user(&filter, (void *)arg, sizeof(filter))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (filter.num < 0 || filter.num > ARRAY_SIZE(filter.pid)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		switch (filter.mode) {
+		case PTX_HW_PID_FILTER_DEFAULT:
+			ret = chrdev->ops->set_pid_filter(chrdev, NULL);
+			if (!ret)
+				chrdev->hw_pid_filter = false;
+			break;
+
+		case PTX_HW_PID_FILTER_PASS:
+		case PTX_HW_PID_FILTER_BLOCK:
+			ret = chrdev->ops->set_pid_filter(chrdev, &filter);
+			if (!ret)
+				chrdev->hw_pid_filter = true;
+			break;
+
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		break;
+	}
+
+	case PTX_SET_SERVICE_FILTER:
+		if (arg > 0xffff) {
+			ret = -EINVAL;
+			break;
+		}
+
+		WRITE_ONCE(chrdev->service_enabled, false);
+		WRITE_ONCE(chrdev->pid_filter_enabled, false);
+
+		if (chrdev->hw_pid_filter) {
+			chrdev->ops->set_pid_filter(chrdev, NULL);
+			chrdev->hw_pid_filter = false;
+		}
+
+		if (!arg)
+			break;
+
+		/*
+		 * The stream handler may be inside ptx_service_process() right
+		 * now, so it resets the service state itself when it sees the
+		 * new generation.
+		 */
+		chrdev->service_req = arg;
+		smp_store_release(&chrdev->service_gen, chrdev->service_gen + 1);
+		smp_store_release(&chrdev->service_enabled, true);
+		break;
+
+	case PTX_SET_OVERFLOW_POLICY:
+		switch (arg) {
+		case PTX_OVERFLOW_DROP_NEWEST:
+		case PTX_OVERFLOW_DROP_OLDEST:
+			chrdev->overflow_policy = arg;
+			ptx_chrdev_update_overflow_policy(chrdev);
+			break;
+
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		break;
+
 	case PTX_SET_SYSTEM_MODE:
 	{
 		enum ptx_system_type mode = (enum ptx_system_type)arg;
@@ -529,7 +1090,14 @@ static long ptx_chrdev_unlocked_ioctl(struct file *file,
 static struct file_operations ptx_chrdev_fops = {
 	.owner = THIS_MODULE,
 	.open = ptx_chrdev_open,
-	.read = ptx_chrdev_read,
+	.read_iter = ptx_chrdev_read_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.poll = ptx_chrdev_poll,
+	.mmap = ptx_chrdev_mmap,
 	.release = ptx_chrdev_release,
 	.unlocked_ioctl = ptx_chrdev_unlocked_ioctl
 };
@@ -756,13 +1324,255 @@ exit:
 	return ret;
 }
 
+/* streaming statistics, since the last PTX_START_STREAMING */
+static void ptx_chrdev_read_stats(struct ptx_chrdev *chrdev,
+				  struct ptx_chrdev_stats *stats)
+{
+	unsigned int start;
+
+	/* not cleared by the stream handler yet */
+	if (smp_load_acquire(&chrdev->stats_reset_gen) !=
+	    READ_ONCE(chrdev->stats_applied_gen)) {
+		stats->packets = 0;
+		stats->bytes = 0;
+		stats->cc_errors = 0;
+		stats->tei_packets = 0;
+		return;
+	}
+
+	do {
+		start = u64_stats_fetch_begin(&chrdev->stats.syncp);
+		stats->packets = chrdev->stats.packets;
+		stats->bytes = chrdev->stats.bytes;
+		stats->cc_errors = chrdev->stats.cc_errors;
+		stats->tei_packets = chrdev->stats.tei_packets;
+	} while (u64_stats_fetch_retry(&chrdev->stats.syncp, start));
+}
+
+static ssize_t packets_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev_stats stats;
+
+	ptx_chrdev_read_stats(dev_get_drvdata(dev), &stats);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.packets);
+}
+
+static ssize_t bytes_show(struct device *dev,
+			  struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev_stats stats;
+
+	ptx_chrdev_read_stats(dev_get_drvdata(dev), &stats);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.bytes);
+}
+
+static ssize_t cc_errors_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev_stats stats;
+
+	ptx_chrdev_read_stats(dev_get_drvdata(dev), &stats);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.cc_errors);
+}
+
+static ssize_t tei_packets_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev_stats stats;
+
+	ptx_chrdev_read_stats(dev_get_drvdata(dev), &stats);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.tei_packets);
+}
+
+static ssize_t dropped_packets_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	u64 packets, bytes;
+
+	ringbuffer_get_drop_stats(chrdev->ringbuf, &packets, &bytes);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", packets);
+}
+
+static ssize_t dropped_bytes_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	u64 packets, bytes;
+
+	ringbuffer_get_drop_stats(chrdev->ringbuf, &packets, &bytes);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", bytes);
+}
+
+/* counted by the demultiplexer, shared by all tuners of the device */
+static ssize_t resync_events_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	const struct ts_demux_stats *stats = chrdev->parent->stream_stats;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n",
+			 (stats) ? READ_ONCE(stats->resync) : 0);
+}
+
+static ssize_t invalid_id_packets_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	const struct ts_demux_stats *stats = chrdev->parent->stream_stats;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n",
+			 (stats) ? READ_ONCE(stats->invalid_id) : 0);
+}
+
+static ssize_t ring_size_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%zu\n",
+			 ringbuffer_size(chrdev->ringbuf));
+}
+
+static ssize_t ring_fill_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n",
+			 ringbuffer_readable_size(chrdev->ringbuf));
+}
+
+static ssize_t ring_fill_max_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%zu\n",
+			 ringbuffer_fill_max(chrdev->ringbuf));
+}
+
+static ssize_t wakeups_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%lld\n",
+			 (long long)atomic64_read(&chrdev->wakeups));
+}
+
+static ssize_t latency_enable_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+			 READ_ONCE(chrdev->latency_enabled) ? 1 : 0);
+}
+
+static ssize_t latency_enable_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int ret = 0;
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	bool enable;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&chrdev->lock);
+
+	if (enable != chrdev->latency_enabled) {
+		if (enable)
+			ret = ptx_chrdev_alloc_arrival(chrdev);
+
+		if (!ret) {
+			smp_store_release(&chrdev->arrival_users,
+					  chrdev->arrival_users + ((enable) ? 1 : -1));
+			smp_store_release(&chrdev->latency_enabled, enable);
+		}
+	}
+
+	mutex_unlock(&chrdev->lock);
+
+	return (ret) ? ret : count;
+}
+
+static ssize_t latency_histogram_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct ptx_chrdev *chrdev = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	/* "<lower bound in usecs> <count>" for each bucket */
+	for (i = 0; i < PTX_CHRDEV_LATENCY_BUCKETS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%lu %lld\n",
+				 (i) ? 1UL << (i - 1) : 0UL,
+				 (long long)atomic64_read(&chrdev->latency_hist[i]));
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(packets);
+static DEVICE_ATTR_RO(bytes);
+static DEVICE_ATTR_RO(cc_errors);
+static DEVICE_ATTR_RO(tei_packets);
+static DEVICE_ATTR_RO(dropped_packets);
+static DEVICE_ATTR_RO(dropped_bytes);
+static DEVICE_ATTR_RO(resync_events);
+static DEVICE_ATTR_RO(invalid_id_packets);
+static DEVICE_ATTR_RO(ring_size);
+static DEVICE_ATTR_RO(ring_fill);
+static DEVICE_ATTR_RO(ring_fill_max);
+static DEVICE_ATTR_RO(wakeups);
+static DEVICE_ATTR_RW(latency_enable);
+static DEVICE_ATTR_RO(latency_histogram);
+
+static struct attribute *ptx_chrdev_stats_attrs[] = {
+	&dev_attr_packets.attr,
+	&dev_attr_bytes.attr,
+	&dev_attr_cc_errors.attr,
+	&dev_attr_tei_packets.attr,
+	&dev_attr_dropped_packets.attr,
+	&dev_attr_dropped_bytes.attr,
+	&dev_attr_resync_events.attr,
+	&dev_attr_invalid_id_packets.attr,
+	&dev_attr_ring_size.attr,
+	&dev_attr_ring_fill.attr,
+	&dev_attr_ring_fill_max.attr,
+	&dev_attr_wakeups.attr,
+	&dev_attr_latency_enable.attr,
+	&dev_attr_latency_histogram.attr,
+	NULL
+};
+
+static const struct attribute_group ptx_chrdev_stats_group = {
+	.name = "stats",
+	.attrs = ptx_chrdev_stats_attrs
+};
+
+static const struct attribute_group *ptx_chrdev_attr_groups[] = {
+	&ptx_chrdev_stats_group,
+	NULL
+};
+
 int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 				 struct device *dev,
 				 const struct ptx_chrdev_group_config *config,
 				 struct ptx_chrdev_group **chrdev_group)
 {
 	int ret = 0;
-	unsigned int i, num, base;
+	unsigned int i, j, num, base;
 	struct ptx_chrdev_group *group = NULL;
 
 	if (!chrdev_ctx || !dev || !config)
@@ -822,6 +1632,7 @@ int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 	group->owner_kref_release = config->owner_kref_release;
 	group->minor_base = MINOR(chrdev_ctx->dev_base) + base;
 	group->chrdev_num = 0;
+	group->stream_stats = config->stream_stats;
 
 	for (i = 0; i < num; i++) {
 		struct ptx_chrdev *chrdev = &group->chrdev[i];
@@ -839,6 +1650,47 @@ int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 		init_waitqueue_head(&chrdev->ringbuf_wait);
 		chrdev->ringbuf_threshold_size = chrdev_config->ringbuf_threshold_size;
 		chrdev->ringbuf_write_size = 0;
+		u64_stats_init(&chrdev->stats.syncp);
+		chrdev->stats.packets = 0;
+		chrdev->stats.bytes = 0;
+		chrdev->stats.cc_errors = 0;
+		chrdev->stats.tei_packets = 0;
+		chrdev->stats_reset_gen = 0;
+		chrdev->stats_applied_gen = 0;
+		chrdev->cc = NULL;
+		atomic64_set(&chrdev->wakeups, 0);
+		INIT_LIST_HEAD(&chrdev->files);
+		chrdev->wakeup_size = chrdev->ringbuf_threshold_size;
+		chrdev->max_latency_ns = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+		hrtimer_setup(&chrdev->latency_timer, ptx_chrdev_latency_timer,
+			      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+		hrtimer_init(&chrdev->latency_timer,
+			     CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		chrdev->latency_timer.function = ptx_chrdev_latency_timer;
+#endif
+		atomic_set(&chrdev->latency_armed, 0);
+		chrdev->flush_gen = 0;
+		chrdev->arrival_users = 0;
+		chrdev->arrival = NULL;
+		chrdev->arrival_num = 0;
+		chrdev->arrival_time = 0;
+		chrdev->latency_enabled = false;
+		for (j = 0; j < PTX_CHRDEV_LATENCY_BUCKETS; j++)
+			atomic64_set(&chrdev->latency_hist[j], 0);
+		chrdev->batching = false;
+		chrdev->shared_read = false;
+		chrdev->owner_gen = 0;
+		chrdev->reader_num = 0;
+		chrdev->overflow_policy = PTX_OVERFLOW_DROP_NEWEST;
+		chrdev->pid_filter_enabled = false;
+		chrdev->hw_pid_filter = false;
+		chrdev->service_enabled = false;
+		chrdev->service_req = 0;
+		chrdev->service_gen = 0;
+		chrdev->service_applied_gen = 0;
+		INIT_WORK(&chrdev->service_work, ptx_chrdev_service_work);
 		chrdev->priv = chrdev_config->priv;
 
 		ret = ringbuffer_create(&chrdev->ringbuf);
@@ -861,9 +1713,18 @@ int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 			break;
 		}
 
+		chrdev->cc = kzalloc(8192, GFP_KERNEL);
+		if (!chrdev->cc) {
+			ret = -ENOMEM;
+			ringbuffer_destroy(chrdev->ringbuf);
+			mutex_destroy(&chrdev->lock);
+			break;
+		}
+
 		if (chrdev->ops->init) {
 			ret = chrdev->ops->init(chrdev);
 			if (ret) {
+				kfree(chrdev->cc);
 				ringbuffer_destroy(chrdev->ringbuf);
 				mutex_destroy(&chrdev->lock);
 				dev_err(dev,
@@ -914,10 +1775,12 @@ int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 			}
 			dev_info(dev, "/dev/%s%u: Digibest %s\n", chrdev_ctx->devname, base + i, model_name);
 		}
-		device_create(chrdev_ctx->class, dev,
-			      MKDEV(MAJOR(chrdev_ctx->dev_base),
-				    group->minor_base + i),
-			      NULL, "%s%u", chrdev_ctx->devname, base + i);
+		device_create_with_groups(chrdev_ctx->class, dev,
+					  MKDEV(MAJOR(chrdev_ctx->dev_base),
+						group->minor_base + i),
+					  &group->chrdev[i],
+					  ptx_chrdev_attr_groups,
+					  "%s%u", chrdev_ctx->devname, base + i);
 	}
 
 	kref_init(&group->kref);
@@ -940,6 +1803,7 @@ fail_chrdev:
 				chrdev->ops->term(chrdev);
 
 			ringbuffer_destroy(chrdev->ringbuf);
+			kfree(chrdev->cc);
 			mutex_destroy(&chrdev->lock);
 		}
 
@@ -996,10 +1860,15 @@ static void ptx_chrdev_group_release(struct kref *kref)
 	for (i = 0; i < num; i++) {
 		struct ptx_chrdev *chrdev = &group->chrdev[i];
 
+		cancel_work_sync(&chrdev->service_work);
+		hrtimer_cancel(&chrdev->latency_timer);
+
 		if (chrdev->ops->term)
 			chrdev->ops->term(chrdev);
 
 		ringbuffer_destroy(chrdev->ringbuf);
+		vfree(chrdev->arrival);
+		kfree(chrdev->cc);
 		mutex_destroy(&chrdev->lock);
 	}
 
@@ -1055,20 +1924,307 @@ void ptx_chrdev_group_destroy(struct ptx_chrdev_group *chrdev_group)
 	return;
 }
 
-int ptx_chrdev_put_stream(struct ptx_chrdev *chrdev, void *buf, size_t len)
+static enum hrtimer_restart ptx_chrdev_latency_timer(struct hrtimer *timer)
+{
+	struct ptx_chrdev *chrdev = container_of(timer,
+						 struct ptx_chrdev,
+						 latency_timer);
+
+	WRITE_ONCE(chrdev->flush_gen, chrdev->flush_gen + 1);
+	atomic_set_release(&chrdev->latency_armed, 0);
+	atomic64_inc(&chrdev->wakeups);
+	trace_ptx_chrdev_wakeup(chrdev, READ_ONCE(chrdev->ringbuf_write_size),
+				true);
+	wake_up(&chrdev->ringbuf_wait);
+
+	return HRTIMER_NORESTART;
+}
+
+static void ptx_chrdev_check_threshold(struct ptx_chrdev *chrdev)
+{
+	u64 max_latency_ns;
+
+	if (unlikely(chrdev->ringbuf_write_size >= READ_ONCE(chrdev->wakeup_size))) {
+		atomic64_inc(&chrdev->wakeups);
+		trace_ptx_chrdev_wakeup(chrdev, chrdev->ringbuf_write_size, false);
+		wake_up(&chrdev->ringbuf_wait);
+		chrdev->ringbuf_write_size = 0;
+		return;
+	}
+
+	/* bound the time the data below the threshold waits for a reader */
+	max_latency_ns = READ_ONCE(chrdev->max_latency_ns);
+	if (max_latency_ns && chrdev->ringbuf_write_size &&
+	    !atomic_cmpxchg(&chrdev->latency_armed, 0, 1))
+		hrtimer_start(&chrdev->latency_timer,
+			      ns_to_ktime(max_latency_ns), HRTIMER_MODE_REL);
+}
+
+static void ptx_chrdev_stamp_arrival(struct ptx_chrdev *chrdev, size_t len)
+{
+	u32 *arrival = smp_load_acquire(&chrdev->arrival);
+	u32 time, idx, num = chrdev->arrival_num;
+	size_t i;
+
+	time = (chrdev->batching) ? chrdev->arrival_time
+				  : ptx_chrdev_arrival_time_now();
+
+	/* stamps for packets which end up being dropped are simply overwritten */
+	div_u64_rem(div_u64(ringbuffer_write_pos(chrdev->ringbuf), 188),
+		    num, &idx);
+
+	for (i = 0; i < len / 188; i++) {
+		WRITE_ONCE(arrival[idx], time);
+
+		if (++idx == num)
+			idx = 0;
+	}
+}
+
+static void ptx_chrdev_count_stream(struct ptx_chrdev *chrdev, size_t len)
+{
+	if (unlikely(!len))
+		return;
+
+	u64_stats_update_begin(&chrdev->stats.syncp);
+	chrdev->stats.packets += len / 188;
+	chrdev->stats.bytes += len;
+	u64_stats_update_end(&chrdev->stats.syncp);
+}
+
+static int ptx_chrdev_write_stream(struct ptx_chrdev *chrdev,
+				   void *buf, size_t len)
 {
 	int ret = 0;
 
+	if (unlikely(smp_load_acquire(&chrdev->arrival_users)))
+		ptx_chrdev_stamp_arrival(chrdev, len);
+
+	if (likely(chrdev->batching)) {
+		ret = ringbuffer_write_put(chrdev->ringbuf, buf, &len);
+		ptx_chrdev_count_stream(chrdev, len);
+		chrdev->ringbuf_write_size += len;
+
+		/* readers are woken up on commit */
+		return ret;
+	}
+
 	ret = ringbuffer_write_atomic(chrdev->ringbuf, buf, &len);
 	if (unlikely(ret && ret != -EOVERFLOW))
 		return ret;
 
+	ptx_chrdev_count_stream(chrdev, len);
 	chrdev->ringbuf_write_size += len;
+	ptx_chrdev_check_threshold(chrdev);
 
-	if (unlikely(chrdev->ringbuf_write_size >= chrdev->ringbuf_threshold_size)) {
-		wake_up(&chrdev->ringbuf_wait);
-		chrdev->ringbuf_write_size -= chrdev->ringbuf_threshold_size;
+	return ret;
+}
+
+static int ptx_chrdev_write_stream_filtered(struct ptx_chrdev *chrdev,
+					    const u8 *filter,
+					    u8 *buf, size_t len)
+{
+	int ret = 0;
+	u8 *p = buf, *run = NULL;
+
+	/* write each run of consecutive passing packets at once */
+	while (likely(len >= 188)) {
+		u16 pid = ((p[1] & 0x1f) << 8) | p[2];
+
+		if (filter[pid >> 3] & (1 << (pid & 0x07))) {
+			if (!run)
+				run = p;
+		} else if (run) {
+			ret = ptx_chrdev_write_stream(chrdev, run, p - run);
+			run = NULL;
+		}
+
+		p += 188;
+		len -= 188;
+	}
+
+	if (run)
+		ret = ptx_chrdev_write_stream(chrdev, run, p - run);
+
+	return ret;
+}
+
+static void ptx_chrdev_service_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ptx_chrdev *chrdev = container_of(work,
+						 struct ptx_chrdev,
+						 service_work);
+	struct ptx_service *svc = &chrdev->service;
+	struct ptx_hw_pid_filter filter;
+
+	mutex_lock(&chrdev->lock);
+
+	if (!READ_ONCE(chrdev->service_enabled))
+		goto exit;
+
+	/* the stream handler queues this again if the pid set changes meanwhile */
+	filter.num = READ_ONCE(svc->pid_num);
+
+	if (!ptx_service_is_known(svc) || filter.num > ARRAY_SIZE(filter.pid)) {
+		/* pass everything so that the PMT can still be found */
+		ret = chrdev->ops->set_pid_filter(chrdev, NULL);
+	} else {
+		filter.mode = PTX_HW_PID_FILTER_PASS;
+		memcpy(filter.pid, svc->pid, sizeof(filter.pid[0]) * filter.num);
+
+		ret = chrdev->ops->set_pid_filter(chrdev, &filter);
+	}
+
+	chrdev->hw_pid_filter = true;
+
+	if (ret)
+		dev_err(chrdev->parent->dev,
+			"ptx_chrdev_service_work %u:%u: set_pid_filter() failed. (ret: %d)\n",
+			chrdev->parent->id, chrdev->id, ret);
+
+exit:
+	mutex_unlock(&chrdev->lock);
+	return;
+}
+
+static void ptx_chrdev_follow_service(struct ptx_chrdev *chrdev,
+				      u8 *buf, size_t len)
+{
+	unsigned int gen = smp_load_acquire(&chrdev->service_gen);
+	bool changed = false;
+
+	if (unlikely(gen != chrdev->service_applied_gen)) {
+		ptx_service_init(&chrdev->service, READ_ONCE(chrdev->service_req));
+		chrdev->service_applied_gen = gen;
+		changed = true;
 	}
 
+	while (likely(len >= 188)) {
+		changed |= ptx_service_process(&chrdev->service, buf);
+
+		buf += 188;
+		len -= 188;
+	}
+
+	if (likely(!changed))
+		return;
+
+	if (chrdev->ops && chrdev->ops->set_pid_filter)
+		schedule_work(&chrdev->service_work);
+}
+
+/*
+ * Stream handlers which deliver many packets per transfer wrap them between
+ * ptx_chrdev_put_stream_begin() and ptx_chrdev_put_stream_commit(), so that
+ * the ring buffer is published and readers are woken up once per transfer.
+ */
+void ptx_chrdev_put_stream_begin(struct ptx_chrdev *chrdev)
+{
+	if (unlikely(READ_ONCE(chrdev->arrival_users)))
+		chrdev->arrival_time = ptx_chrdev_arrival_time_now();
+
+	ringbuffer_write_begin(chrdev->ringbuf);
+	chrdev->batching = true;
+}
+
+void ptx_chrdev_put_stream_commit(struct ptx_chrdev *chrdev)
+{
+	chrdev->batching = false;
+	ringbuffer_write_commit(chrdev->ringbuf);
+	ptx_chrdev_check_threshold(chrdev);
+}
+
+/*
+ * Counts continuity_counter discontinuities and packets with
+ * transport_error_indicator set, on everything the tuner delivers.
+ */
+static void ptx_chrdev_check_stream(struct ptx_chrdev *chrdev,
+				    const u8 *buf, size_t len)
+{
+	u8 *cc = chrdev->cc;
+	u32 cc_errors = 0, tei_packets = 0;
+
+	while (likely(len >= 188)) {
+		u16 pid = ((buf[1] & 0x1f) << 8) | buf[2];
+		u8 afc = (buf[3] & 0x30) >> 4, counter = buf[3] & 0x0f;
+
+		if (unlikely(buf[1] & 0x80)) {
+			tei_packets++;
+		} else if (likely(pid != 0x1fff)) {
+			u8 last = cc[pid];
+
+			/* skip the check when discontinuity_indicator is set */
+			if (likely((last & 0x10) &&
+				   !((afc & 0x02) && buf[4] && (buf[5] & 0x80)))) {
+				u8 expected = last & 0x0f;
+
+				/* no increment without payload, one duplicate is allowed */
+				if ((afc & 0x01) && counter != expected)
+					expected = (expected + 1) & 0x0f;
+
+				if (unlikely(counter != expected))
+					cc_errors++;
+			}
+
+			cc[pid] = 0x10 | counter;
+		}
+
+		buf += 188;
+		len -= 188;
+	}
+
+	if (likely(!cc_errors && !tei_packets))
+		return;
+
+	u64_stats_update_begin(&chrdev->stats.syncp);
+	chrdev->stats.cc_errors += cc_errors;
+	chrdev->stats.tei_packets += tei_packets;
+	u64_stats_update_end(&chrdev->stats.syncp);
+}
+
+static void ptx_chrdev_apply_stats_reset(struct ptx_chrdev *chrdev)
+{
+	unsigned int gen = smp_load_acquire(&chrdev->stats_reset_gen);
+
+	if (likely(gen == chrdev->stats_applied_gen))
+		return;
+
+	u64_stats_update_begin(&chrdev->stats.syncp);
+	chrdev->stats.packets = 0;
+	chrdev->stats.bytes = 0;
+	chrdev->stats.cc_errors = 0;
+	chrdev->stats.tei_packets = 0;
+	u64_stats_update_end(&chrdev->stats.syncp);
+
+	memset(chrdev->cc, 0, 8192);
+
+	WRITE_ONCE(chrdev->stats_applied_gen, gen);
+}
+
+int ptx_chrdev_put_stream(struct ptx_chrdev *chrdev, void *buf, size_t len)
+{
+	int ret = 0;
+
+	ptx_chrdev_apply_stats_reset(chrdev);
+
+	if (likely(ringbuffer_is_running(chrdev->ringbuf)))
+		ptx_chrdev_check_stream(chrdev, buf, len);
+
+	if (unlikely(smp_load_acquire(&chrdev->service_enabled))) {
+		ptx_chrdev_follow_service(chrdev, buf, len);
+		ret = ptx_chrdev_write_stream_filtered(chrdev,
+						       chrdev->service.map,
+						       buf, len);
+	} else if (unlikely(smp_load_acquire(&chrdev->pid_filter_enabled))) {
+		ret = ptx_chrdev_write_stream_filtered(chrdev,
+						       chrdev->pid_filter,
+						       buf, len);
+	} else {
+		ret = ptx_chrdev_write_stream(chrdev, buf, len);
+	}
+
+	trace_ptx_chrdev_put_stream(chrdev, len);
+
 	return ret;
 }
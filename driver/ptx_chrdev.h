@@ -15,9 +15,14 @@
 #include <linux/wait.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/u64_stats_sync.h>
 
 #include "ptx_ioctl.h"
 #include "ringbuffer.h"
+#include "ptx_service.h"
+#include "ts_demux.h"
 
 struct ptx_tune_params {
 	enum ptx_system_type system;
@@ -43,6 +48,8 @@ struct ptx_chrdev_operations {
 	int (*read_signal_strength)(struct ptx_chrdev *chrdev, u32 *value);
 	int (*read_cnr)(struct ptx_chrdev *chrdev, u32 *value);
 	int (*read_cnr_raw)(struct ptx_chrdev *chrdev, u32 *value);
+	int (*set_pid_filter)(struct ptx_chrdev *chrdev,
+			      const struct ptx_hw_pid_filter *filter);
 };
 
 #define PTX_CHRDEV_SAT_SET_STREAM_ID_BEFORE_TUNE	0x00000010
@@ -50,6 +57,9 @@ struct ptx_chrdev_operations {
 #define PTX_CHRDEV_WAIT_AFTER_LOCK			0x00000040
 #define PTX_CHRDEV_WAIT_AFTER_LOCK_TC_T			0x00000080
 
+// delivery latency histogram: bucket 0 is < 1us, bucket n is [2^(n-1), 2^n) us
+#define PTX_CHRDEV_LATENCY_BUCKETS	24
+
 struct ptx_chrdev_config {
 	enum ptx_system_type system_cap;
 	const struct ptx_chrdev_operations *ops;
@@ -66,6 +76,16 @@ struct ptx_chrdev_group_config {
 	unsigned int minor_base;
 	unsigned int chrdev_num;
 	struct ptx_chrdev_config *chrdev_config;
+	const struct ts_demux_stats *stream_stats;
+};
+
+// updated by the stream handler only
+struct ptx_chrdev_stats {
+	struct u64_stats_sync syncp;
+	u64 packets;
+	u64 bytes;
+	u64 cc_errors;
+	u64 tei_packets;
 };
 
 struct ptx_chrdev {
@@ -84,9 +104,54 @@ struct ptx_chrdev {
 	wait_queue_head_t ringbuf_wait;
 	size_t ringbuf_threshold_size;
 	size_t ringbuf_write_size;
+	struct ptx_chrdev_stats stats;
+	unsigned int stats_reset_gen;	// stats and cc are cleared by the stream handler
+	unsigned int stats_applied_gen;	// stream handler only
+	u8 *cc;		// last continuity_counter of each pid, 0x10: seen
+	atomic64_t wakeups;
+	struct list_head files;
+	size_t wakeup_size;
+	u64 max_latency_ns;
+	struct hrtimer latency_timer;
+	atomic_t latency_armed;
+	unsigned int flush_gen;
+	unsigned int arrival_users;	// M2TS readers and latency tracking
+	u32 *arrival;	// arrival time of each packet in the ring buffer
+	u32 arrival_num;
+	u32 arrival_time;	// of the current batch
+	bool latency_enabled;
+	atomic64_t latency_hist[PTX_CHRDEV_LATENCY_BUCKETS];
+	bool batching;
+	bool shared_read;
+	unsigned int owner_gen;
+	unsigned int reader_num;	// attached to the current owner
+	enum ptx_overflow_policy overflow_policy;	// chosen by the owner
+	bool pid_filter_enabled;
+	u8 pid_filter[8192 / 8];
+	bool hw_pid_filter;
+	bool service_enabled;
+	u16 service_req;	// applied by the stream handler
+	unsigned int service_gen;
+	unsigned int service_applied_gen;	// stream handler only
+	struct ptx_service service;	// stream handler only
+	struct work_struct service_work;
 	void *priv;
 };
 
+struct ptx_chrdev_file {
+	struct list_head list;
+	struct ptx_chrdev *chrdev;
+	bool owner;
+	unsigned int owner_gen;
+	u64 pos;
+	u64 read_bytes;
+	u64 lost_bytes;
+	size_t low_watermark;
+	u64 max_latency_ns;
+	unsigned int flush_gen;
+	bool m2ts;
+};
+
 struct ptx_chrdev_group {
 	struct list_head list;
 	struct mutex lock;
@@ -100,6 +165,7 @@ struct ptx_chrdev_group {
 	void (*owner_kref_release)(struct kref *);
 	unsigned int minor_base;
 	unsigned int chrdev_num;
+	const struct ts_demux_stats *stream_stats;	// shared by the group
 	struct ptx_chrdev chrdev[];
 };
 
@@ -133,6 +199,8 @@ int ptx_chrdev_context_add_group(struct ptx_chrdev_context *chrdev_ctx,
 int ptx_chrdev_context_remove_group(struct ptx_chrdev_context *chrdev_ctx,
 				    unsigned int minor_base);
 void ptx_chrdev_group_destroy(struct ptx_chrdev_group *chrdev_group);
+void ptx_chrdev_put_stream_begin(struct ptx_chrdev *chrdev);
 int ptx_chrdev_put_stream(struct ptx_chrdev *chrdev, void *buf, size_t len);
+void ptx_chrdev_put_stream_commit(struct ptx_chrdev *chrdev);
 
 #endif
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Service following PID selector (ptx_service.c)
+ *
+ * Tracks the PAT and the PMT of a single service in a transport stream and
+ * keeps the set of pids which belong to the service up to date.
+ */
+
+#include "ptx_service.h"
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/crc32.h>
+
+/* PSI/SI pids which are always passed */
+static const u16 ptx_service_si_pids[] = {
+	0x0000,	/* PAT */
+	0x0001,	/* CAT */
+	0x0010,	/* NIT */
+	0x0011,	/* SDT/BAT */
+	0x0012,	/* EIT */
+	0x0013,	/* RST */
+	0x0014,	/* TDT/TOT */
+	0x0023,	/* SDTT */
+	0x0024,	/* BIT */
+	0x0026,	/* EIT (L-EIT) */
+	0x0027,	/* EIT (M-EIT) */
+	0x0028,	/* SDTT */
+	0x0029	/* CDT */
+};
+
+static void ptx_service_add_pid(struct ptx_service *svc, u16 pid)
+{
+	if (svc->map[pid >> 3] & (1 << (pid & 0x07)))
+		return;
+
+	svc->map[pid >> 3] |= (1 << (pid & 0x07));
+
+	/* pid_num keeps counting so that an overflow can be detected */
+	if (svc->pid_num < PTX_SERVICE_MAX_PIDS)
+		svc->pid[svc->pid_num] = pid;
+
+	svc->pid_num++;
+}
+
+static void ptx_service_reset_pids(struct ptx_service *svc)
+{
+	int i;
+
+	memset(svc->map, 0, sizeof(svc->map));
+	svc->pid_num = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ptx_service_si_pids); i++)
+		ptx_service_add_pid(svc, ptx_service_si_pids[i]);
+}
+
+void ptx_service_init(struct ptx_service *svc, u16 service_id)
+{
+	svc->service_id = service_id;
+	svc->pmt_pid = 0;
+	svc->pat_version = -1;
+	svc->pmt_version = -1;
+	svc->pat.len = -1;
+	svc->pmt.len = -1;
+
+	ptx_service_reset_pids(svc);
+}
+
+static int ptx_service_section_size(const u8 *buf)
+{
+	return 3 + (((buf[1] & 0x0f) << 8) | buf[2]);
+}
+
+static bool ptx_service_section_push(struct ptx_service_section *sec,
+				     const u8 *data, int len)
+{
+	int size;
+
+	if (sec->len < 0)
+		return false;
+
+	if (len > (int)sizeof(sec->buf) - sec->len)
+		len = sizeof(sec->buf) - sec->len;
+
+	memcpy(sec->buf + sec->len, data, len);
+	sec->len += len;
+
+	if (sec->len < 3)
+		return false;
+
+	if (sec->buf[0] == 0xff) {
+		/* stuffing */
+		sec->len = -1;
+		return false;
+	}
+
+	size = ptx_service_section_size(sec->buf);
+	if (size > sizeof(sec->buf) || size < 12) {
+		sec->len = -1;
+		return false;
+	}
+
+	if (sec->len < size)
+		return false;
+
+	sec->len = -1;
+
+	/* long form, current, first section, and an intact CRC_32 */
+	return ((sec->buf[1] & 0x80) && (sec->buf[5] & 0x01) && !sec->buf[6] &&
+		!crc32_be(0xffffffff, sec->buf, size));
+}
+
+static void ptx_service_add_ca_pids(struct ptx_service *svc,
+				    const u8 *p, int len)
+{
+	while (len >= 2) {
+		int desc_len = p[1];
+
+		if (desc_len + 2 > len)
+			break;
+
+		/* CA_descriptor */
+		if (p[0] == 0x09 && desc_len >= 4)
+			ptx_service_add_pid(svc, ((p[4] & 0x1f) << 8) | p[5]);
+
+		p += desc_len + 2;
+		len -= desc_len + 2;
+	}
+}
+
+static bool ptx_service_parse_pat(struct ptx_service *svc)
+{
+	const u8 *buf = svc->pat.buf;
+	int version, i, size = ptx_service_section_size(buf);
+	u16 pmt_pid = 0;
+
+	if (buf[0] != 0x00)
+		return false;
+
+	version = (buf[5] >> 1) & 0x1f;
+	if (version == svc->pat_version)
+		return false;
+
+	svc->pat_version = version;
+
+	for (i = 8; i + 4 <= size - 4; i += 4) {
+		if (((buf[i] << 8) | buf[i + 1]) == svc->service_id) {
+			pmt_pid = ((buf[i + 2] & 0x1f) << 8) | buf[i + 3];
+			break;
+		}
+	}
+
+	if (pmt_pid == svc->pmt_pid)
+		return false;
+
+	/* the pid set is unknown until the new PMT arrives */
+	svc->pmt_pid = pmt_pid;
+	svc->pmt_version = -1;
+	svc->pmt.len = -1;
+	ptx_service_reset_pids(svc);
+
+	/* pass the PMT itself from now on */
+	if (pmt_pid)
+		ptx_service_add_pid(svc, pmt_pid);
+
+	return true;
+}
+
+static bool ptx_service_parse_pmt(struct ptx_service *svc)
+{
+	const u8 *buf = svc->pmt.buf;
+	int version, i, info_len, size = ptx_service_section_size(buf);
+	u16 pcr_pid;
+
+	if (buf[0] != 0x02 || ((buf[3] << 8) | buf[4]) != svc->service_id)
+		return false;
+
+	version = (buf[5] >> 1) & 0x1f;
+	if (version == svc->pmt_version)
+		return false;
+
+	svc->pmt_version = version;
+
+	ptx_service_reset_pids(svc);
+	ptx_service_add_pid(svc, svc->pmt_pid);
+
+	pcr_pid = ((buf[8] & 0x1f) << 8) | buf[9];
+	if (pcr_pid != 0x1fff)
+		ptx_service_add_pid(svc, pcr_pid);
+
+	info_len = ((buf[10] & 0x0f) << 8) | buf[11];
+	if (12 + info_len > size - 4)
+		return true;
+
+	ptx_service_add_ca_pids(svc, buf + 12, info_len);
+
+	for (i = 12 + info_len; i + 5 <= size - 4; i += 5 + info_len) {
+		ptx_service_add_pid(svc, ((buf[i + 1] & 0x1f) << 8) | buf[i + 2]);
+
+		info_len = ((buf[i + 3] & 0x0f) << 8) | buf[i + 4];
+		if (i + 5 + info_len > size - 4)
+			break;
+
+		ptx_service_add_ca_pids(svc, buf + i + 5, info_len);
+	}
+
+	return true;
+}
+
+/*
+ * Feeds one 188 bytes packet. Returns true when the pid set has changed.
+ */
+bool ptx_service_process(struct ptx_service *svc, const u8 *packet)
+{
+	u16 pid = ((packet[1] & 0x1f) << 8) | packet[2];
+	struct ptx_service_section *sec;
+	bool (*parse)(struct ptx_service *svc);
+	const u8 *payload = packet + 4;
+	int len = 184;
+	bool changed = false;
+
+	if (pid == 0x0000) {
+		sec = &svc->pat;
+		parse = ptx_service_parse_pat;
+	} else if (svc->pmt_pid && pid == svc->pmt_pid) {
+		sec = &svc->pmt;
+		parse = ptx_service_parse_pmt;
+	} else {
+		return false;
+	}
+
+	if (packet[1] & 0x80) {
+		/* transport_error_indicator */
+		sec->len = -1;
+		return false;
+	}
+
+	if (packet[3] & 0x20) {
+		/* adaptation field */
+		len -= 1 + packet[4];
+		payload += 1 + packet[4];
+	}
+
+	if (!(packet[3] & 0x10) || len <= 0)
+		return false;
+
+	if (packet[1] & 0x40) {
+		/* payload_unit_start_indicator */
+		int pointer = payload[0];
+
+		payload++;
+		len--;
+
+		if (pointer > len) {
+			sec->len = -1;
+			return false;
+		}
+
+		if (ptx_service_section_push(sec, payload, pointer))
+			changed = parse(svc);
+
+		payload += pointer;
+		len -= pointer;
+		sec->len = 0;
+	}
+
+	if (ptx_service_section_push(sec, payload, len))
+		changed |= parse(svc);
+
+	return changed;
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Service following PID selector definitions (ptx_service.h)
+ */
+
+#ifndef __PTX_SERVICE_H__
+#define __PTX_SERVICE_H__
+
+#include <linux/types.h>
+
+#define PTX_SERVICE_MAX_PIDS	64
+
+struct ptx_service_section {
+	int len;	// -1: waiting for the start of a section
+	u8 buf[1024];
+};
+
+struct ptx_service {
+	u16 service_id;
+	u16 pmt_pid;	// 0: not found in the PAT yet
+	int pat_version;
+	int pmt_version;	// -1: the pid set is not known yet
+	struct ptx_service_section pat;
+	struct ptx_service_section pmt;
+	int pid_num;
+	u16 pid[PTX_SERVICE_MAX_PIDS];
+	u8 map[8192 / 8];
+};
+
+void ptx_service_init(struct ptx_service *svc, u16 service_id);
+bool ptx_service_process(struct ptx_service *svc, const u8 *packet);
+
+static inline bool ptx_service_is_known(struct ptx_service *svc)
+{
+	return (svc->pmt_version >= 0);
+}
+
+#endif
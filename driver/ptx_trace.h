@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Tracepoints for the streaming path (ptx_trace.h)
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM px4_drv
+
+#if !defined(__PTX_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __PTX_TRACE_H__
+
+#include <linux/types.h>
+#include <linux/usb.h>
+#include <linux/tracepoint.h>
+
+#include "ptx_chrdev.h"
+#include "ringbuffer.h"
+
+TRACE_EVENT(itedtv_usb_complete,
+	TP_PROTO(struct usb_device *dev, u32 len, u32 urbs),
+	TP_ARGS(dev, len, urbs),
+	TP_STRUCT__entry(
+		__field(int, busnum)
+		__field(int, devnum)
+		__field(u32, len)
+		__field(u32, urbs)
+	),
+	TP_fast_assign(
+		__entry->busnum = dev->bus->busnum;
+		__entry->devnum = dev->devnum;
+		__entry->len = len;
+		__entry->urbs = urbs;
+	),
+	TP_printk("usb %d-%d: len=%u urbs=%u",
+		  __entry->busnum, __entry->devnum, __entry->len, __entry->urbs)
+);
+
+TRACE_EVENT(ptx_chrdev_put_stream,
+	TP_PROTO(struct ptx_chrdev *chrdev, size_t len),
+	TP_ARGS(chrdev, len),
+	TP_STRUCT__entry(
+		__field(unsigned int, group)
+		__field(unsigned int, id)
+		__field(size_t, len)
+		__field(u64, fill)
+	),
+	TP_fast_assign(
+		__entry->group = chrdev->parent->id;
+		__entry->id = chrdev->id;
+		__entry->len = len;
+		__entry->fill = ringbuffer_readable_size(chrdev->ringbuf);
+	),
+	TP_printk("%u:%u len=%zu fill=%llu",
+		  __entry->group, __entry->id, __entry->len,
+		  (unsigned long long)__entry->fill)
+);
+
+TRACE_EVENT(ptx_chrdev_wakeup,
+	TP_PROTO(struct ptx_chrdev *chrdev, size_t size, bool timer),
+	TP_ARGS(chrdev, size, timer),
+	TP_STRUCT__entry(
+		__field(unsigned int, group)
+		__field(unsigned int, id)
+		__field(size_t, size)
+		__field(bool, timer)
+	),
+	TP_fast_assign(
+		__entry->group = chrdev->parent->id;
+		__entry->id = chrdev->id;
+		__entry->size = size;
+		__entry->timer = timer;
+	),
+	TP_printk("%u:%u size=%zu%s",
+		  __entry->group, __entry->id, __entry->size,
+		  (__entry->timer) ? " timer" : "")
+);
+
+TRACE_EVENT(ptx_chrdev_read,
+	TP_PROTO(struct ptx_chrdev *chrdev, bool owner, ssize_t ret, u64 wait_ns),
+	TP_ARGS(chrdev, owner, ret, wait_ns),
+	TP_STRUCT__entry(
+		__field(unsigned int, group)
+		__field(unsigned int, id)
+		__field(bool, owner)
+		__field(ssize_t, ret)
+		__field(u64, wait_ns)
+	),
+	TP_fast_assign(
+		__entry->group = chrdev->parent->id;
+		__entry->id = chrdev->id;
+		__entry->owner = owner;
+		__entry->ret = ret;
+		__entry->wait_ns = wait_ns;
+	),
+	TP_printk("%u:%u%s ret=%zd wait_ns=%llu",
+		  __entry->group, __entry->id,
+		  (__entry->owner) ? "" : " reader", __entry->ret,
+		  (unsigned long long)__entry->wait_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ptx_trace
+
+#include <trace/define_trace.h>
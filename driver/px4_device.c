@@ -14,14 +14,11 @@
 
 #include "px4_device_params.h"
 #include "firmware.h"
-
-#define PX4_DEVICE_TS_SYNC_COUNT	4
-#define PX4_DEVICE_TS_SYNC_SIZE		(188 * PX4_DEVICE_TS_SYNC_COUNT)
+#include "ts_demux.h"
 
 struct px4_stream_context {
 	struct ptx_chrdev *chrdev[PX4_CHRDEV_NUM];
-	u8 remain_buf[PX4_DEVICE_TS_SYNC_SIZE];
-	size_t remain_len;
+	struct ts_demux demux;
 };
 
 static int px4_chrdev_set_lnb_voltage_s(struct ptx_chrdev *chrdev, int voltage);
@@ -131,91 +128,28 @@ static int px4_backend_term(struct px4_device *px4)
 	return 0;
 }
 
-static void px4_device_stream_process(struct ptx_chrdev **chrdev,
-				      u8 **buf, u32 *len)
+static void px4_device_stream_put(void *context, int id, u8 *buf, u32 len)
 {
-	u8 *p = *buf;
-	u32 remain = *len;
-
-	while (likely(remain)) {
-		u32 i;
-		bool sync_remain = false;
-
-		for (i = 0; i < PX4_DEVICE_TS_SYNC_COUNT; i++) {
-			if (likely(((i + 1) * 188) <= remain)) {
-				if (unlikely((p[i * 188] & 0x8f) != 0x07))
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-		}
-
-		if (unlikely(sync_remain))
-			break;
-
-		if (unlikely(i < PX4_DEVICE_TS_SYNC_COUNT)) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		while (likely(remain >= 188 && ((p[0] & 0x8f) == 0x07))) {
-			u8 id = (p[0] & 0x70) >> 4;
-
-			if (likely(id && id < 5)) {
-				p[0] = 0x47;
-				ptx_chrdev_put_stream(chrdev[id - 1], p, 188);
-			}
-
-			p += 188;
-			remain -= 188;
-		}
-	}
-
-	*buf = p;
-	*len = remain;
+	struct px4_stream_context *stream_ctx = context;
 
-	return;
+	ptx_chrdev_put_stream(stream_ctx->chrdev[id], buf, len);
 }
 
 static int px4_device_stream_handler(void *context, void *buf, u32 len)
 {
 	struct px4_stream_context *stream_ctx = context;
-	u8 *ctx_remain_buf = stream_ctx->remain_buf;
-	u32 ctx_remain_len = stream_ctx->remain_len;
-	u8 *p = buf;
-	u32 remain = len;
-
-	if (unlikely(ctx_remain_len)) {
-		if (likely((ctx_remain_len + len) >= PX4_DEVICE_TS_SYNC_SIZE)) {
-			u32 t = PX4_DEVICE_TS_SYNC_SIZE - ctx_remain_len;
-
-			memcpy(ctx_remain_buf + ctx_remain_len, p, t);
-			ctx_remain_len = PX4_DEVICE_TS_SYNC_SIZE;
-
-			px4_device_stream_process(stream_ctx->chrdev,
-						  &ctx_remain_buf,
-						  &ctx_remain_len);
-			if (likely(!ctx_remain_len)) {
-				p += t;
-				remain -= t;
-			}
-
-			stream_ctx->remain_len = 0;
-		} else {
-			memcpy(ctx_remain_buf + ctx_remain_len, p, len);
-			stream_ctx->remain_len += len;
+	int i;
 
-			return 0;
-		}
+	for (i = 0; i < PX4_CHRDEV_NUM; i++) {
+		if (stream_ctx->chrdev[i])
+			ptx_chrdev_put_stream_begin(stream_ctx->chrdev[i]);
 	}
 
-	px4_device_stream_process(stream_ctx->chrdev, &p, &remain);
+	ts_demux_process(&stream_ctx->demux, buf, len);
 
-	if (unlikely(remain)) {
-		memcpy(stream_ctx->remain_buf, p, remain);
-		stream_ctx->remain_len = remain;
+	for (i = 0; i < PX4_CHRDEV_NUM; i++) {
+		if (stream_ctx->chrdev[i])
+			ptx_chrdev_put_stream_commit(stream_ctx->chrdev[i]);
 	}
 
 	return 0;
@@ -924,7 +858,7 @@ static int px4_chrdev_start_capture(struct ptx_chrdev *chrdev)
 	if (!px4->streaming_count) {
 		struct px4_stream_context *stream_ctx = px4->stream_ctx;
 
-		stream_ctx->remain_len = 0;
+		ts_demux_reset(&stream_ctx->demux);
 
 		ret = itedtv_bus_start_streaming(&px4->it930x.bus,
 						 px4_device_stream_handler,
@@ -1036,6 +970,15 @@ static int px4_chrdev_read_cnr_raw_s(struct ptx_chrdev *chrdev, u32 *value)
 	return tc90522_get_cn_s(&chrdev4->tc90522, (u16 *)value);
 }
 
+static int px4_chrdev_set_pid_filter(struct ptx_chrdev *chrdev,
+				     const struct ptx_hw_pid_filter *filter)
+{
+	struct px4_chrdev *chrdev4 = chrdev->priv;
+
+	return it930x_apply_ptx_pid_filter(&chrdev4->parent->it930x, chrdev->id, filter,
+					   px4_device_params.discard_null_packets);
+}
+
 static struct ptx_chrdev_operations px4_chrdev_t_ops = {
 	.init = px4_chrdev_init,
 	.term = px4_chrdev_term_t,
@@ -1048,7 +991,8 @@ static struct ptx_chrdev_operations px4_chrdev_t_ops = {
 	.set_capture = px4_chrdev_set_capture,
 	.read_signal_strength = NULL,
 	.read_cnr = NULL,
-	.read_cnr_raw = px4_chrdev_read_cnr_raw_t
+	.read_cnr_raw = px4_chrdev_read_cnr_raw_t,
+	.set_pid_filter = px4_chrdev_set_pid_filter
 };
 
 static struct ptx_chrdev_operations px4_chrdev_s_ops = {
@@ -1063,7 +1007,8 @@ static struct ptx_chrdev_operations px4_chrdev_s_ops = {
 	.set_capture = px4_chrdev_set_capture,
 	.read_signal_strength = NULL,
 	.read_cnr = NULL,
-	.read_cnr_raw = px4_chrdev_read_cnr_raw_s
+	.read_cnr_raw = px4_chrdev_read_cnr_raw_s,
+	.set_pid_filter = px4_chrdev_set_pid_filter
 };
 
 static int px4_parse_serial_number(struct px4_serial_number *serial,
@@ -1342,6 +1287,7 @@ int px4_device_init(struct px4_device *px4, struct device *dev,
 	chrdev_group_config.minor_base = 0;	/* unused */
 	chrdev_group_config.chrdev_num = 4;
 	chrdev_group_config.chrdev_config = chrdev_config;
+	chrdev_group_config.stream_stats = &stream_ctx->demux.stats;
 
 	ret = ptx_chrdev_context_add_group(chrdev_ctx, dev,
 					   &chrdev_group_config, &chrdev_group);
@@ -1355,6 +1301,9 @@ int px4_device_init(struct px4_device *px4, struct device *dev,
 		stream_ctx->chrdev[i] = &chrdev_group->chrdev[i];
 	}
 
+	ts_demux_init(&stream_ctx->demux, TS_DEMUX_FORMAT_TAGGED,
+		      PX4_CHRDEV_NUM, px4_device_stream_put, stream_ctx);
+
 	atomic_set(&px4->available, 1);
 	return 0;
 
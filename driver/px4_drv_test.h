@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Definitions shared by the KUnit suites of px4_drv (px4_drv_test.h)
+ */
+
+#ifndef __PX4_DRV_TEST_H__
+#define __PX4_DRV_TEST_H__
+
+#include <linux/types.h>
+#include <kunit/test.h>
+
+// amount of data each microbenchmark pushes through
+#define PX4_DRV_TEST_BENCH_SIZE	(64 * 1024 * 1024)
+
+extern struct kunit_suite ringbuffer_test_suite;
+extern struct kunit_suite ts_demux_test_suite;
+extern struct kunit_suite it930x_test_suite;
+
+// the byte at stream position pos of the test pattern
+static inline u8 px4_drv_test_byte(u64 pos)
+{
+	return (u8)(pos ^ (pos >> 8) ^ (pos >> 16));
+}
+
+void px4_drv_test_fill(u8 *buf, size_t len, u64 pos);
+bool px4_drv_test_check(const u8 *buf, size_t len, u64 pos);
+void px4_drv_test_report(struct kunit *test, const char *name,
+			 u64 bytes, u64 ns);
+
+#endif
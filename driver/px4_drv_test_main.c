@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit test module of px4_drv (px4_drv_test_main.c)
+ *
+ * Each suite builds the unit under test into this module, so that nothing
+ * has to be exported from px4_drv for testing. No hardware is needed.
+ */
+
+#include "px4_drv_test.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/math64.h>
+
+void px4_drv_test_fill(u8 *buf, size_t len, u64 pos)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = px4_drv_test_byte(pos + i);
+}
+
+bool px4_drv_test_check(const u8 *buf, size_t len, u64 pos)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != px4_drv_test_byte(pos + i))
+			return false;
+	}
+
+	return true;
+}
+
+/* throughput of a microbenchmark, in MB/s */
+void px4_drv_test_report(struct kunit *test, const char *name,
+			 u64 bytes, u64 ns)
+{
+	if (!ns)
+		ns = 1;
+
+	kunit_info(test, "%s: %llu MB/s (%llu bytes in %llu ns)\n",
+		   name, div64_u64(bytes * 1000, ns), bytes, ns);
+}
+
+kunit_test_suites(&ringbuffer_test_suite,
+		  &ts_demux_test_suite,
+		  &it930x_test_suite);
+
+MODULE_DESCRIPTION("KUnit tests for px4_drv");
+MODULE_LICENSE("GPL v2");
@@ -15,7 +15,11 @@
 #include <linux/slab.h>
 #include <linux/module.h>
 #include <linux/device.h>
+#include <linux/sysfs.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
 #include <linux/usb.h>
+#include <linux/version.h>
 
 #include "px4_usb_params.h"
 #include "px4_device_params.h"
@@ -61,6 +65,9 @@
 #endif
 #define PXS1UR_USB_MAX_CHRDEV	(PXS1UR_USB_MAX_DEVICE * S1UR_CHRDEV_NUM)
 
+#define PX4_USB_MAX_URBS		32
+#define PX4_USB_MAX_URB_PACKETS		2048
+
 
 struct px4_usb_context {
 	enum px4_usb_device_type type;
@@ -87,6 +94,12 @@ static int px4_usb_init_bridge(struct device *dev, struct usb_device *usb_dev,
 	bus->usb.ctrl_timeout = px4_usb_params.ctrl_timeout;
 	bus->usb.streaming.urb_buffer_size = 188 * px4_usb_params.urb_max_packets;
 	bus->usb.streaming.urb_num = px4_usb_params.max_urbs;
+	bus->usb.streaming.xfer_size = 188 * px4_usb_params.xfer_packets;
+	bus->usb.streaming.auto_tune = px4_usb_params.urb_auto_tune;
+	bus->usb.streaming.thread.enable = px4_usb_params.stream_thread;
+	bus->usb.streaming.thread.cpu = px4_usb_params.stream_thread_cpu;
+	bus->usb.streaming.thread.nice = px4_usb_params.stream_thread_nice;
+	bus->usb.streaming.thread.fifo = px4_usb_params.stream_thread_fifo;
 	bus->usb.streaming.no_dma = px4_usb_params.no_dma;
 
 	it930x->dev = dev;
@@ -96,6 +109,369 @@ static int px4_usb_init_bridge(struct device *dev, struct usb_device *usb_dev,
 	return 0;
 }
 
+static struct itedtv_bus *px4_usb_get_bus(struct device *dev)
+{
+	struct px4_usb_context *ctx = dev_get_drvdata(dev);
+
+	switch (ctx->type) {
+	case PX4_USB_DEVICE:
+		return &ctx->ctx.px4.it930x.bus;
+
+	case PXMLT5_USB_DEVICE:
+	case PXMLT8_USB_DEVICE:
+	case ISDB6014_4TS_USB_DEVICE:
+		return &ctx->ctx.pxmlt.it930x.bus;
+
+	case ISDB2056_USB_DEVICE:
+		return &ctx->ctx.isdb2056.it930x.bus;
+
+	case PXM1UR_USB_DEVICE:
+		return &ctx->ctx.m1ur.it930x.bus;
+
+	case PXS1UR_USB_DEVICE:
+		return &ctx->ctx.s1ur.it930x.bus;
+
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * URB parameters, applied when the bridge starts streaming next time.
+ * Setting either of them by hand turns auto-tuning off. urb_packets has to
+ * be a multiple of the max packet size in bytes, or no fewer than
+ * xfer_packets.
+ */
+static ssize_t urb_num_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(bus->usb.streaming.urb_num));
+}
+
+static ssize_t urb_num_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	unsigned int val;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (!val || val > PX4_USB_MAX_URBS)
+		return -EINVAL;
+
+	WRITE_ONCE(bus->usb.streaming.auto_tune, false);
+	WRITE_ONCE(bus->usb.streaming.urb_num, val);
+
+	return count;
+}
+
+static ssize_t urb_packets_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 READ_ONCE(bus->usb.streaming.urb_buffer_size) / 188);
+}
+
+static ssize_t urb_packets_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	unsigned int val;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (!val || val > PX4_USB_MAX_URB_PACKETS ||
+	    !itedtv_bus_usb_urb_size_valid(bus, 188 * val))
+		return -EINVAL;
+
+	WRITE_ONCE(bus->usb.streaming.auto_tune, false);
+	WRITE_ONCE(bus->usb.streaming.urb_buffer_size, 188 * val);
+
+	return count;
+}
+
+static ssize_t urb_auto_tune_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+			 READ_ONCE(bus->usb.streaming.auto_tune));
+}
+
+static ssize_t urb_auto_tune_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	bool val;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(bus->usb.streaming.auto_tune, val);
+
+	return count;
+}
+
+/* stream thread parameters, applied when the bridge starts streaming */
+static ssize_t stream_thread_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+			 READ_ONCE(bus->usb.streaming.thread.enable));
+}
+
+static ssize_t stream_thread_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	bool val;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(bus->usb.streaming.thread.enable, val);
+
+	return count;
+}
+
+static ssize_t stream_thread_cpu_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+			 READ_ONCE(bus->usb.streaming.thread.cpu));
+}
+
+static ssize_t stream_thread_cpu_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	int val;
+
+	ret = kstrtoint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val < -1 || val >= nr_cpu_ids)
+		return -EINVAL;
+
+	WRITE_ONCE(bus->usb.streaming.thread.cpu, val);
+
+	return count;
+}
+
+static ssize_t stream_thread_nice_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+			 READ_ONCE(bus->usb.streaming.thread.nice));
+}
+
+static ssize_t stream_thread_nice_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	int ret = 0;
+	struct itedtv_bus *bus = px4_usb_get_bus(dev);
+	int val;
+
+	ret = kstrtoint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val < MIN_NICE || val > MAX_NICE)
+		return -EINVAL;
+
+	WRITE_ONCE(bus->usb.streaming.thread.nice, val);
+
+	return count;
+}
+
+/* URB error counters */
+static ssize_t urb_errors_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.urb_errors);
+}
+
+static ssize_t urb_resubmits_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.urb_resubmits);
+}
+
+static ssize_t endpoint_resets_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.endpoint_resets);
+}
+
+static ssize_t urb_last_error_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", stats.last_error);
+}
+
+/* URB transfer telemetry */
+static ssize_t urb_submit_errors_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n", stats.submit_errors);
+}
+
+static ssize_t urb_in_flight_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	int ret;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	/* current, lowest since streaming started, allocated */
+	return scnprintf(buf, PAGE_SIZE, "%u %u %u\n",
+			 stats.in_flight, stats.in_flight_min, stats.urb_num);
+}
+
+static ssize_t urb_fill_histogram_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct itedtv_bus_stats stats;
+	ssize_t len = 0;
+	int ret, i;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	/* "<lower bound in percent> <count>" for each bucket */
+	for (i = 0; i < ITEDTV_BUS_FILL_BUCKETS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %llu\n",
+				 i * 100 / ITEDTV_BUS_FILL_BUCKETS,
+				 stats.fill_hist[i]);
+
+	return len;
+}
+
+static ssize_t urb_interval_histogram_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct itedtv_bus_stats stats;
+	ssize_t len = 0;
+	int ret, i;
+
+	ret = itedtv_bus_get_stats(px4_usb_get_bus(dev), &stats);
+	if (ret)
+		return ret;
+
+	/* "<lower bound in usecs> <count>" for each bucket */
+	for (i = 0; i < ITEDTV_BUS_INTERVAL_BUCKETS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%lu %llu\n",
+				 (i) ? 1UL << (i - 1) : 0UL,
+				 stats.interval_hist[i]);
+
+	return len;
+}
+
+static DEVICE_ATTR_RW(urb_num);
+static DEVICE_ATTR_RW(urb_packets);
+static DEVICE_ATTR_RW(urb_auto_tune);
+static DEVICE_ATTR_RW(stream_thread);
+static DEVICE_ATTR_RW(stream_thread_cpu);
+static DEVICE_ATTR_RW(stream_thread_nice);
+static DEVICE_ATTR_RO(urb_errors);
+static DEVICE_ATTR_RO(urb_resubmits);
+static DEVICE_ATTR_RO(endpoint_resets);
+static DEVICE_ATTR_RO(urb_last_error);
+static DEVICE_ATTR_RO(urb_submit_errors);
+static DEVICE_ATTR_RO(urb_in_flight);
+static DEVICE_ATTR_RO(urb_fill_histogram);
+static DEVICE_ATTR_RO(urb_interval_histogram);
+
+static struct attribute *px4_usb_attrs[] = {
+	&dev_attr_urb_num.attr,
+	&dev_attr_urb_packets.attr,
+	&dev_attr_urb_auto_tune.attr,
+	&dev_attr_stream_thread.attr,
+	&dev_attr_stream_thread_cpu.attr,
+	&dev_attr_stream_thread_nice.attr,
+	&dev_attr_urb_errors.attr,
+	&dev_attr_urb_resubmits.attr,
+	&dev_attr_endpoint_resets.attr,
+	&dev_attr_urb_last_error.attr,
+	&dev_attr_urb_submit_errors.attr,
+	&dev_attr_urb_in_flight.attr,
+	&dev_attr_urb_fill_histogram.attr,
+	&dev_attr_urb_interval_histogram.attr,
+	NULL
+};
+
+ATTRIBUTE_GROUPS(px4_usb);
+
 static int px4_usb_probe(struct usb_interface *intf,
 			 const struct usb_device_id *id)
 {
@@ -260,6 +636,11 @@ static int px4_usb_probe(struct usb_interface *intf,
 	get_device(dev);
 	usb_set_intfdata(intf, ctx);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+	if (sysfs_create_groups(&dev->kobj, px4_usb_groups))
+		dev_warn(dev, "px4_usb_probe: sysfs_create_groups() failed.\n");
+#endif
+
 	return 0;
 
 fail:
@@ -279,6 +660,9 @@ static void px4_usb_disconnect(struct usb_interface *intf)
 		return;
 	}
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+	sysfs_remove_groups(&intf->dev.kobj, px4_usb_groups);
+#endif
 	usb_set_intfdata(intf, NULL);
 
 	switch (ctx->type) {
@@ -359,7 +743,10 @@ static struct usb_driver px4_usb_driver = {
 	.disconnect = px4_usb_disconnect,
 	.suspend = px4_usb_suspend,
 	.resume = px4_usb_resume,
-	.id_table = px4_usb_ids
+	.id_table = px4_usb_ids,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	.dev_groups = px4_usb_groups
+#endif
 };
 
 int px4_usb_register()
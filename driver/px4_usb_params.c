@@ -15,6 +15,11 @@ struct px4_usb_param_set px4_usb_params = {
 	.xfer_packets = 816,
 	.urb_max_packets = 816,
 	.max_urbs = 6,
+	.urb_auto_tune = false,
+	.stream_thread = false,
+	.stream_thread_cpu = -1,
+	.stream_thread_nice = 0,
+	.stream_thread_fifo = false,
 	.no_dma = false
 };
 
@@ -38,5 +43,32 @@ module_param_named(max_urbs, px4_usb_params.max_urbs,
 		   uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(max_urbs, "Maximum number of URBs. (default: 6)");
 
+module_param_named(urb_auto_tune, px4_usb_params.urb_auto_tune,
+		   bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(urb_auto_tune,
+		 "Choose the URB size and number from the measured bitrate " \
+		 "at the end of each streaming session. (default: N)");
+
+module_param_named(stream_thread, px4_usb_params.stream_thread,
+		   bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(stream_thread,
+		 "Process the received stream in a thread per device " \
+		 "instead of the URB completion handler. (default: N)");
+
+module_param_named(stream_thread_cpu, px4_usb_params.stream_thread_cpu,
+		   int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(stream_thread_cpu,
+		 "CPU to run the stream thread on, -1 for any. (default: -1)");
+
+module_param_named(stream_thread_nice, px4_usb_params.stream_thread_nice,
+		   int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(stream_thread_nice,
+		 "Nice value of the stream thread. (default: 0)");
+
+module_param_named(stream_thread_fifo, px4_usb_params.stream_thread_fifo,
+		   bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(stream_thread_fifo,
+		 "Run the stream thread with SCHED_FIFO. (default: N)");
+
 module_param_named(no_dma, px4_usb_params.no_dma,
 		   bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
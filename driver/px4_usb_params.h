@@ -10,6 +10,11 @@ struct px4_usb_param_set {
 	unsigned int xfer_packets;
 	unsigned int urb_max_packets;
 	unsigned int max_urbs;
+	bool urb_auto_tune;
+	bool stream_thread;
+	int stream_thread_cpu;
+	int stream_thread_nice;
+	bool stream_thread_fifo;
 	bool no_dma;
 };
 
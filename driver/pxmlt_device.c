@@ -14,14 +14,11 @@
 
 #include "px4_device_params.h"
 #include "firmware.h"
-
-#define PXMLT_DEVICE_TS_SYNC_COUNT	4
-#define PXMLT_DEVICE_TS_SYNC_SIZE	(188 * PXMLT_DEVICE_TS_SYNC_COUNT)
+#include "ts_demux.h"
 
 struct pxmlt_stream_context {
 	struct ptx_chrdev *chrdev[PXMLT_CHRDEV_MAX_NUM];
-	u8 remain_buf[PXMLT_DEVICE_TS_SYNC_SIZE];
-	size_t remain_len;
+	struct ts_demux demux;
 };
 
 static int pxmlt_chrdev_set_lnb_voltage(struct ptx_chrdev *chrdev, int voltage);
@@ -107,91 +104,28 @@ static int pxmlt_backend_term(struct pxmlt_device *pxmlt)
 }
 #endif
 
-static void pxmlt_device_stream_process(struct ptx_chrdev **chrdev,
-				      u8 **buf, u32 *len)
+static void pxmlt_device_stream_put(void *context, int id, u8 *buf, u32 len)
 {
-	u8 *p = *buf;
-	u32 remain = *len;
-
-	while (likely(remain)) {
-		u32 i;
-		bool sync_remain = false;
-
-		for (i = 0; i < PXMLT_DEVICE_TS_SYNC_COUNT; i++) {
-			if (likely(((i + 1) * 188) <= remain)) {
-				if (unlikely((p[i * 188] & 0x8f) != 0x07))
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-		}
-
-		if (unlikely(sync_remain))
-			break;
-
-		if (unlikely(i < PXMLT_DEVICE_TS_SYNC_COUNT)) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		while (likely(remain >= 188 && ((p[0] & 0x8f) == 0x07))) {
-			u8 id = (p[0] & 0x70) >> 4;
-
-			if (likely(id && id < 6)) {
-				p[0] = 0x47;
-				ptx_chrdev_put_stream(chrdev[id - 1], p, 188);
-			}
-
-			p += 188;
-			remain -= 188;
-		}
-	}
-
-	*buf = p;
-	*len = remain;
+	struct pxmlt_stream_context *stream_ctx = context;
 
-	return;
+	ptx_chrdev_put_stream(stream_ctx->chrdev[id], buf, len);
 }
 
 static int pxmlt_device_stream_handler(void *context, void *buf, u32 len)
 {
 	struct pxmlt_stream_context *stream_ctx = context;
-	u8 *ctx_remain_buf = stream_ctx->remain_buf;
-	u32 ctx_remain_len = stream_ctx->remain_len;
-	u8 *p = buf;
-	u32 remain = len;
-
-	if (unlikely(ctx_remain_len)) {
-		if (likely((ctx_remain_len + len) >= PXMLT_DEVICE_TS_SYNC_SIZE)) {
-			u32 t = PXMLT_DEVICE_TS_SYNC_SIZE - ctx_remain_len;
-
-			memcpy(ctx_remain_buf + ctx_remain_len, p, t);
-			ctx_remain_len = PXMLT_DEVICE_TS_SYNC_SIZE;
-
-			pxmlt_device_stream_process(stream_ctx->chrdev,
-						  &ctx_remain_buf,
-						  &ctx_remain_len);
-			if (likely(!ctx_remain_len)) {
-				p += t;
-				remain -= t;
-			}
-
-			stream_ctx->remain_len = 0;
-		} else {
-			memcpy(ctx_remain_buf + ctx_remain_len, p, len);
-			stream_ctx->remain_len += len;
+	int i;
 
-			return 0;
-		}
+	for (i = 0; i < PXMLT_CHRDEV_MAX_NUM; i++) {
+		if (stream_ctx->chrdev[i])
+			ptx_chrdev_put_stream_begin(stream_ctx->chrdev[i]);
 	}
 
-	pxmlt_device_stream_process(stream_ctx->chrdev, &p, &remain);
+	ts_demux_process(&stream_ctx->demux, buf, len);
 
-	if (unlikely(remain)) {
-		memcpy(stream_ctx->remain_buf, p, remain);
-		stream_ctx->remain_len = remain;
+	for (i = 0; i < PXMLT_CHRDEV_MAX_NUM; i++) {
+		if (stream_ctx->chrdev[i])
+			ptx_chrdev_put_stream_commit(stream_ctx->chrdev[i]);
 	}
 
 	return 0;
@@ -578,7 +512,7 @@ static int pxmlt_chrdev_start_capture(struct ptx_chrdev *chrdev)
 			goto exit;
 		}
 
-		stream_ctx->remain_len = 0;
+		ts_demux_reset(&stream_ctx->demux);
 
 		ret = itedtv_bus_start_streaming(&pxmlt->it930x.bus,
 						 pxmlt_device_stream_handler,
@@ -836,6 +770,15 @@ static int pxmlt_chrdev_read_cnr_raw(struct ptx_chrdev *chrdev, u32 *value)
 	return ret;
 }
 
+static int pxmlt_chrdev_set_pid_filter(struct ptx_chrdev *chrdev,
+				       const struct ptx_hw_pid_filter *filter)
+{
+	struct pxmlt_chrdev *chrdevm = chrdev->priv;
+
+	return it930x_apply_ptx_pid_filter(&chrdevm->parent->it930x, chrdev->id, filter,
+					   px4_device_params.discard_null_packets);
+}
+
 static struct ptx_chrdev_operations pxmlt_chrdev_ops = {
 	.init = pxmlt_chrdev_init,
 	.term = pxmlt_chrdev_term,
@@ -848,7 +791,8 @@ static struct ptx_chrdev_operations pxmlt_chrdev_ops = {
 	.set_capture = pxmlt_chrdev_set_capture,
 	.read_signal_strength = NULL,
 	.read_cnr = NULL,
-	.read_cnr_raw = pxmlt_chrdev_read_cnr_raw
+	.read_cnr_raw = pxmlt_chrdev_read_cnr_raw,
+	.set_pid_filter = pxmlt_chrdev_set_pid_filter
 };
 
 static const struct {
@@ -1070,6 +1014,7 @@ int pxmlt_device_init(struct pxmlt_device *pxmlt, struct device *dev,
 	chrdev_group_config.minor_base = 0;	/* unused */
 	chrdev_group_config.chrdev_num = pxmlt->chrdevm_num;
 	chrdev_group_config.chrdev_config = chrdev_config;
+	chrdev_group_config.stream_stats = &stream_ctx->demux.stats;
 
 	ret = ptx_chrdev_context_add_group(chrdev_ctx, dev,
 					   &chrdev_group_config, &chrdev_group);
@@ -1083,6 +1028,9 @@ int pxmlt_device_init(struct pxmlt_device *pxmlt, struct device *dev,
 		stream_ctx->chrdev[i] = &chrdev_group->chrdev[i];
 	}
 
+	ts_demux_init(&stream_ctx->demux, TS_DEMUX_FORMAT_TAGGED,
+		      pxmlt->chrdevm_num, pxmlt_device_stream_put, stream_ctx);
+
 	atomic_set(&pxmlt->available, 1);
 	return 0;
 
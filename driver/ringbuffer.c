@@ -9,10 +9,17 @@
 
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/rcupdate.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+
+#define RINGBUFFER_PACKET_SIZE	188
 
 static void ringbuffer_free_nolock(struct ringbuffer *ringbuf);
 static void ringbuffer_lock(struct ringbuffer *ringbuf);
+static void ringbuffer_unlock(struct ringbuffer *ringbuf);
 
 int ringbuffer_create(struct ringbuffer **ringbuf)
 {
@@ -22,15 +29,40 @@ int ringbuffer_create(struct ringbuffer **ringbuf)
 	if (!p)
 		return -ENOMEM;
 
+	p->ctrl = (struct ptx_mmap_ctrl *)get_zeroed_page(GFP_KERNEL);
+	if (!p->ctrl) {
+		kfree(p);
+		return -ENOMEM;
+	}
+
 	atomic_set(&p->state, 0);
-	atomic_set(&p->rw_count, 0);
+	atomic_set(&p->armed, 0);
 	atomic_set(&p->wait_count, 0);
 	init_waitqueue_head(&p->wait);
+	p->pages = NULL;
+	p->page_num = 0;
 	p->buf = NULL;
 	p->size = 0;
-	atomic_set(&p->actual_size, 0);
-	atomic_set(&p->head, 0);
-	atomic_set(&p->tail, 0);
+	p->policy = PTX_OVERFLOW_DROP_NEWEST;
+
+	p->producer.active = false;
+	p->producer.tail = 0;
+	p->producer.space = 0;
+	p->producer.len = 0;
+	p->producer.read = 0;
+	atomic64_set(&p->producer.dropped_packets, 0);
+	atomic64_set(&p->producer.dropped_bytes, 0);
+	p->producer.fill_max = 0;
+	atomic64_set(&p->written, 0);
+	atomic64_set(&p->reserved, 0);
+
+	mutex_init(&p->consumer.lock);
+	atomic_set(&p->consumer.busy, 0);
+	p->consumer.head = 0;
+	p->consumer.written = 0;
+	atomic64_set(&p->read, 0);
+
+	atomic_set(&p->snoop_busy, 0);
 
 	*ringbuf = p;
 
@@ -43,6 +75,10 @@ int ringbuffer_destroy(struct ringbuffer *ringbuf)
 
 	ringbuffer_lock(ringbuf);
 	ringbuffer_free_nolock(ringbuf);
+	ringbuffer_unlock(ringbuf);
+
+	mutex_destroy(&ringbuf->consumer.lock);
+	free_page((unsigned long)ringbuf->ctrl);
 	kfree(ringbuf);
 
 	return 0;
@@ -50,29 +86,115 @@ int ringbuffer_destroy(struct ringbuffer *ringbuf)
 
 static void ringbuffer_free_nolock(struct ringbuffer *ringbuf)
 {
+	unsigned int i;
+
 	if (ringbuf->buf)
-		free_pages((unsigned long)ringbuf->buf,
-			   get_order(ringbuf->size));
+		vunmap(ringbuf->buf);
 
+	if (ringbuf->pages) {
+		for (i = 0; i < ringbuf->page_num; i++)
+			__free_page(ringbuf->pages[i]);
+
+		kvfree(ringbuf->pages);
+	}
+
+	ringbuf->pages = NULL;
+	ringbuf->page_num = 0;
 	ringbuf->buf = NULL;
 	ringbuf->size = 0;
+	ringbuf->ctrl->size = 0;
 
 	return;
 }
 
+static int ringbuffer_alloc_nolock(struct ringbuffer *ringbuf, size_t size)
+{
+	unsigned int i, page_num = size >> PAGE_SHIFT;
+	struct page **pages;
+
+	/* page_num entries for the pages, and page_num more for the mirror */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+	pages = kvmalloc_array(page_num * 2, sizeof(*pages), GFP_KERNEL);
+#else
+	pages = vmalloc(page_num * 2 * sizeof(*pages));
+#endif
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < page_num; i++) {
+		pages[i] = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+		if (!pages[i])
+			goto fail;
+
+		pages[page_num + i] = pages[i];
+	}
+
+	ringbuf->buf = vmap(pages, page_num * 2, VM_MAP, PAGE_KERNEL);
+	if (!ringbuf->buf)
+		goto fail;
+
+	ringbuf->pages = pages;
+	ringbuf->page_num = page_num;
+	ringbuf->size = size;
+
+	return 0;
+
+fail:
+	while (i--)
+		__free_page(pages[i]);
+
+	kvfree(pages);
+
+	return -ENOMEM;
+}
+
 static void ringbuffer_reset_nolock(struct ringbuffer *ringbuf)
 {
-	atomic_set(&ringbuf->actual_size, 0);
-	atomic_set(&ringbuf->head, 0);
-	atomic_set(&ringbuf->tail, 0);
+	struct ptx_mmap_ctrl *ctrl = ringbuf->ctrl;
+	u64 written = atomic64_read(&ringbuf->written);
+	u32 tail = 0;
+
+	/* snooping readers locate data by (written % size), keep it that way */
+	if (ringbuf->size)
+		div_u64_rem(written, ringbuf->size, &tail);
+
+	ringbuf->producer.tail = tail;
+	ringbuf->producer.read = written;
+	ringbuf->consumer.head = tail;
+	ringbuf->consumer.written = written;
+	atomic64_set(&ringbuf->read, written);
+	atomic64_set(&ringbuf->producer.dropped_packets, 0);
+	atomic64_set(&ringbuf->producer.dropped_bytes, 0);
+	WRITE_ONCE(ringbuf->producer.fill_max, 0);
+
+	WRITE_ONCE(ctrl->head, tail);
+	WRITE_ONCE(ctrl->tail, tail);
+	WRITE_ONCE(ctrl->written, 0);
+	WRITE_ONCE(ctrl->consumed, 0);
 
 	return;
 }
 
+static bool ringbuffer_is_idle(struct ringbuffer *ringbuf)
+{
+	return !atomic_read(&ringbuf->snoop_busy);
+}
+
+/* callers have stopped the ring buffer beforehand */
 static void ringbuffer_lock(struct ringbuffer *ringbuf)
 {
+	mutex_lock(&ringbuf->consumer.lock);
+
+	/*
+	 * Wait for a batch which has seen the ring buffer running. This is on
+	 * the way to every PTX_START_STREAMING, hence the expedited grace period,
+	 * and there is nothing to wait for if it hasn't run since the last one.
+	 */
+	if (atomic_xchg(&ringbuf->armed, 0))
+		synchronize_rcu_expedited();
+
 	atomic_add_return(1, &ringbuf->wait_count);
-	wait_event(ringbuf->wait, !atomic_read(&ringbuf->rw_count));
+	wait_event(ringbuf->wait, ringbuffer_is_idle(ringbuf));
 
 	return;
 }
@@ -82,14 +204,58 @@ static void ringbuffer_unlock(struct ringbuffer *ringbuf)
 	if (atomic_sub_return(1, &ringbuf->wait_count))
 		wake_up(&ringbuf->wait);
 
+	mutex_unlock(&ringbuf->consumer.lock);
+
 	return;
 }
 
+static void ringbuffer_enter(atomic_t *busy)
+{
+	atomic_add_return_acquire(1, busy);
+}
+
+static void ringbuffer_leave(struct ringbuffer *ringbuf, atomic_t *busy)
+{
+	if (unlikely(!atomic_sub_return(1, busy) &&
+	    atomic_read(&ringbuf->wait_count)))
+		wake_up(&ringbuf->wait);
+}
+
+/* returns true if the consumer has to hand its position back afterwards */
+static bool ringbuffer_consumer_enter(struct ringbuffer *ringbuf)
+{
+	/* the holder may sleep in copy_to_iter() */
+	mutex_lock(&ringbuf->consumer.lock);
+
+	/* the policy only changes under the lock */
+	if (likely(ringbuf->policy != PTX_OVERFLOW_DROP_OLDEST))
+		return false;
+
+	/*
+	 * Only the producer can hold it now, for the few instructions it takes
+	 * to drop the oldest data.
+	 */
+	while (atomic_cmpxchg_acquire(&ringbuf->consumer.busy, 0, 1))
+		cpu_relax();
+
+	return true;
+}
+
+static void ringbuffer_consumer_leave(struct ringbuffer *ringbuf, bool busy)
+{
+	if (busy)
+		atomic_set_release(&ringbuf->consumer.busy, 0);
+
+	mutex_unlock(&ringbuf->consumer.lock);
+}
+
 int ringbuffer_alloc(struct ringbuffer *ringbuf, size_t size)
 {
 	int ret = 0;
 
-	if (size > INT_MAX)
+	/* the mirror mapping works in whole pages */
+	size = PAGE_ALIGN(size);
+	if (!size || size > INT_MAX)
 		return -EINVAL;
 
 	if (atomic_read_acquire(&ringbuf->state))
@@ -100,22 +266,14 @@ int ringbuffer_alloc(struct ringbuffer *ringbuf, size_t size)
 	if (ringbuf->buf && ringbuf->size != size)
 		ringbuffer_free_nolock(ringbuf);
 
-	ringbuf->size = 0;
-	ringbuffer_reset_nolock(ringbuf);
+	/* written keeps counting up so that positions held by readers stay valid */
+	atomic64_set(&ringbuf->reserved, atomic64_read(&ringbuf->written));
 
-	if (!ringbuf->buf) {
-#ifdef __GFP_RETRY_MAYFAIL
-		ringbuf->buf = (u8 *)__get_free_pages(GFP_KERNEL | __GFP_RETRY_MAYFAIL,
-						      get_order(size));
-#else
-		ringbuf->buf = (u8 *)__get_free_pages(GFP_KERNEL | __GFP_REPEAT,
-						      get_order(size));
-#endif
-		if (!ringbuf->buf)
-			ret = -ENOMEM;
-		else
-			ringbuf->size = size;
-	}
+	if (!ringbuf->buf)
+		ret = ringbuffer_alloc_nolock(ringbuf, size);
+
+	ringbuffer_reset_nolock(ringbuf);
+	ringbuf->ctrl->size = ringbuf->size;
 
 	ringbuffer_unlock(ringbuf);
 
@@ -165,109 +323,473 @@ int ringbuffer_stop(struct ringbuffer *ringbuf)
 
 int ringbuffer_ready_read(struct ringbuffer *ringbuf)
 {
+	/* before the producer can see it, see ringbuffer_lock() */
+	atomic_set(&ringbuf->armed, 1);
+
 	if (!atomic_cmpxchg(&ringbuf->state, 1, 2))
 		return -EINVAL;
 
 	return 0;
 }
 
-int ringbuffer_read_user(struct ringbuffer *ringbuf,
-			 void __user *buf, size_t *len)
+/* returns the number of bytes the consumer can take, up to len */
+static size_t ringbuffer_consumer_avail(struct ringbuffer *ringbuf,
+					u64 read, size_t len)
+{
+	u64 avail = ringbuf->consumer.written - read;
+
+	if (avail < len) {
+		ringbuf->consumer.written = atomic64_read_acquire(&ringbuf->written);
+		avail = ringbuf->consumer.written - read;
+	}
+
+	return (avail < len) ? avail : len;
+}
+
+static void ringbuffer_consumer_advance(struct ringbuffer *ringbuf,
+					u64 read, size_t len)
+{
+	size_t head = ringbuf->consumer.head + len;
+
+	if (head >= ringbuf->size)
+		head -= ringbuf->size;
+
+	ringbuf->consumer.head = head;
+	atomic64_set_release(&ringbuf->read, read + len);
+
+	WRITE_ONCE(ringbuf->ctrl->head, head);
+	smp_store_release(&ringbuf->ctrl->consumed,
+			  ringbuf->ctrl->consumed + len);
+}
+
+int ringbuffer_read_iter(struct ringbuffer *ringbuf,
+			 struct iov_iter *iter, size_t *len)
 {
 	int ret = 0;
 	u8 *p;
-	size_t buf_size, actual_size, head, read_size;
+	size_t head, read_size;
+	u64 read;
+	bool busy;
 
-	atomic_add_return_acquire(1, &ringbuf->rw_count);
+	busy = ringbuffer_consumer_enter(ringbuf);
 
 	p = ringbuf->buf;
-	buf_size = ringbuf->size;
-	actual_size = atomic_read_acquire(&ringbuf->actual_size);
-	head = atomic_read(&ringbuf->head);
+	head = ringbuf->consumer.head;
+	read = atomic64_read(&ringbuf->read);
 
-	read_size = (*len <= actual_size) ? *len : actual_size;
+	read_size = ringbuffer_consumer_avail(ringbuf, read, *len);
 	if (likely(read_size)) {
-		unsigned long res;
-
-		if (likely(head + read_size <= buf_size)) {
-			res = copy_to_user(buf, p + head, read_size);
-			if (unlikely(res)) {
-				read_size -= res;
-				ret = -EFAULT;
-			}
-
-			head = (head + read_size == buf_size) ? 0
-							      : (head + read_size);
-		} else {
-			size_t tmp = buf_size - head;
-
-			res = copy_to_user(buf, p + head, tmp);
-			if (likely(!res))
-				res = copy_to_user(((u8 *)buf) + tmp, p,
-						   read_size - tmp);
-
-			if (unlikely(res)) {
-				read_size -= res;
-				ret = -EFAULT;
-			}
-
-			head = read_size - tmp;
+		size_t res = copy_to_iter(p + head, read_size, iter);
+
+		if (unlikely(res != read_size)) {
+			read_size = res;
+			ret = -EFAULT;
 		}
 
-		atomic_xchg(&ringbuf->head, head);
-		atomic_sub_return_release(read_size,
-					  &ringbuf->actual_size);
+		ringbuffer_consumer_advance(ringbuf, read, read_size);
 	}
 
-	if (unlikely(!atomic_sub_return(1, &ringbuf->rw_count) &&
-	    atomic_read(&ringbuf->wait_count)))
-		wake_up(&ringbuf->wait);
+	ringbuffer_consumer_leave(ringbuf, busy);
 
 	*len = read_size;
 
 	return ret;
 }
 
-int ringbuffer_write_atomic(struct ringbuffer *ringbuf,
-			    const void *buf, size_t *len)
+int ringbuffer_snoop_iter(struct ringbuffer *ringbuf, u64 *pos,
+			  struct iov_iter *iter, size_t *len, u64 *lost)
 {
 	int ret = 0;
 	u8 *p;
-	size_t buf_size, actual_size, tail, write_size;
+	u32 head;
+	size_t buf_size, read_size, res;
+	u64 written, reserved, avail;
+
+	ringbuffer_enter(&ringbuf->snoop_busy);
+
+	p = ringbuf->buf;
+	buf_size = ringbuf->size;
+	written = atomic64_read_acquire(&ringbuf->written);
+
+	avail = written - *pos;
+	if (unlikely(avail > buf_size)) {
+		/* overrun: skip to the oldest data, keeping packet alignment */
+		u64 skip = avail - buf_size;
+		u32 rem;
+
+		div_u64_rem(skip, RINGBUFFER_PACKET_SIZE, &rem);
+		if (rem)
+			skip += RINGBUFFER_PACKET_SIZE - rem;
+
+		*pos += skip;
+		*lost += skip;
+		avail -= skip;
+	}
+
+	read_size = (*len <= avail) ? *len : avail;
+	if (likely(read_size)) {
+		div_u64_rem(*pos, buf_size, &head);
+
+		res = copy_to_iter(p + head, read_size, iter);
+
+		if (unlikely(res != read_size)) {
+			read_size = res;
+			ret = -EFAULT;
+		}
+
+		/* the writer may have lapped us while copying */
+		smp_rmb();
+		reserved = atomic64_read(&ringbuf->reserved);
+		if (unlikely(reserved - *pos > buf_size))
+			*lost += min_t(u64, reserved - *pos - buf_size,
+				       read_size);
+
+		*pos += read_size;
+	}
+
+	ringbuffer_leave(ringbuf, &ringbuf->snoop_busy);
+
+	*len = read_size;
+
+	return ret;
+}
+
+/*
+ * Copies num packets starting at offset head (stream position pos), each
+ * preceded by the 4 bytes big endian value returned by prefix().
+ * Returns the number of packets copied.
+ */
+static size_t ringbuffer_copy_prefixed(struct ringbuffer *ringbuf,
+				       u32 head, u64 pos, size_t num,
+				       struct iov_iter *iter,
+				       ringbuffer_prefix_t prefix,
+				       void *context)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		__be32 val = cpu_to_be32(prefix(context, pos));
+
+		if (unlikely(copy_to_iter(&val, sizeof(val), iter) != sizeof(val) ||
+			     copy_to_iter(ringbuf->buf + head,
+					  RINGBUFFER_PACKET_SIZE,
+					  iter) != RINGBUFFER_PACKET_SIZE))
+			break;
+
+		head += RINGBUFFER_PACKET_SIZE;
+		if (head >= ringbuf->size)
+			head -= ringbuf->size;
+
+		pos += RINGBUFFER_PACKET_SIZE;
+	}
+
+	return i;
+}
+
+/*
+ * Reads whole packets with a 4 bytes prefix each. *len counts the prefixes.
+ */
+int ringbuffer_read_prefixed_iter(struct ringbuffer *ringbuf,
+				  struct iov_iter *iter, size_t *len,
+				  ringbuffer_prefix_t prefix, void *context)
+{
+	int ret = 0;
+	size_t num, copied = 0;
+	u64 read;
+	u32 rem;
+	bool busy;
+
+	busy = ringbuffer_consumer_enter(ringbuf);
+
+	read = atomic64_read(&ringbuf->read);
+
+	/*
+	 * A previous plain read may have stopped in the middle of a packet.
+	 * Skip what has been written of its rest, so that an empty ring is
+	 * not seen as readable.
+	 */
+	div_u64_rem(read, RINGBUFFER_PACKET_SIZE, &rem);
+	if (unlikely(rem)) {
+		size_t skip;
+
+		rem = RINGBUFFER_PACKET_SIZE - rem;
+		skip = ringbuffer_consumer_avail(ringbuf, read, rem);
+		if (skip) {
+			ringbuffer_consumer_advance(ringbuf, read, skip);
+			read += skip;
+		}
+
+		if (skip != rem)
+			goto exit;
+	}
+
+	num = *len / (4 + RINGBUFFER_PACKET_SIZE);
+	num = ringbuffer_consumer_avail(ringbuf, read,
+					num * RINGBUFFER_PACKET_SIZE) / RINGBUFFER_PACKET_SIZE;
+	if (likely(num)) {
+		copied = ringbuffer_copy_prefixed(ringbuf, ringbuf->consumer.head,
+						  read, num, iter, prefix, context);
+		if (unlikely(copied != num))
+			ret = -EFAULT;
+
+		ringbuffer_consumer_advance(ringbuf, read,
+					    copied * RINGBUFFER_PACKET_SIZE);
+	}
+
+exit:
+	ringbuffer_consumer_leave(ringbuf, busy);
+
+	*len = copied * (4 + RINGBUFFER_PACKET_SIZE);
+
+	return ret;
+}
+
+int ringbuffer_snoop_prefixed_iter(struct ringbuffer *ringbuf, u64 *pos,
+				   struct iov_iter *iter, size_t *len, u64 *lost,
+				   ringbuffer_prefix_t prefix, void *context)
+{
+	int ret = 0;
+	u32 head, rem;
+	size_t buf_size, num, copied = 0;
+	u64 written, reserved, avail;
+
+	ringbuffer_enter(&ringbuf->snoop_busy);
+
+	buf_size = ringbuf->size;
+	written = atomic64_read_acquire(&ringbuf->written);
+
+	/* never past written, or ringbuffer_snoopable_size() would underflow */
+	div_u64_rem(*pos, RINGBUFFER_PACKET_SIZE, &rem);
+	if (unlikely(rem)) {
+		*pos += RINGBUFFER_PACKET_SIZE - rem;
+		if (unlikely(*pos > written))
+			*pos = written;
+	}
 
-	if (unlikely(atomic_read(&ringbuf->state) != 2))
+	avail = written - *pos;
+	if (unlikely(avail > buf_size)) {
+		/* overrun: skip to the oldest packet */
+		u64 skip = avail - buf_size;
+
+		div_u64_rem(skip, RINGBUFFER_PACKET_SIZE, &rem);
+		if (rem)
+			skip += RINGBUFFER_PACKET_SIZE - rem;
+
+		*pos += skip;
+		*lost += skip;
+		avail -= skip;
+	}
+
+	num = *len / (4 + RINGBUFFER_PACKET_SIZE);
+	if (num > div_u64(avail, RINGBUFFER_PACKET_SIZE))
+		num = div_u64(avail, RINGBUFFER_PACKET_SIZE);
+
+	if (likely(num)) {
+		div_u64_rem(*pos, buf_size, &head);
+
+		copied = ringbuffer_copy_prefixed(ringbuf, head, *pos, num,
+						  iter, prefix, context);
+		if (unlikely(copied != num))
+			ret = -EFAULT;
+
+		/* the writer may have lapped us while copying */
+		smp_rmb();
+		reserved = atomic64_read(&ringbuf->reserved);
+		if (unlikely(reserved - *pos > buf_size))
+			*lost += min_t(u64, reserved - *pos - buf_size,
+				       copied * RINGBUFFER_PACKET_SIZE);
+
+		*pos += copied * RINGBUFFER_PACKET_SIZE;
+	}
+
+	ringbuffer_leave(ringbuf, &ringbuf->snoop_busy);
+
+	*len = copied * (4 + RINGBUFFER_PACKET_SIZE);
+
+	return ret;
+}
+
+int ringbuffer_consume(struct ringbuffer *ringbuf, size_t len)
+{
+	int ret = 0;
+	u64 read;
+	bool busy;
+
+	busy = ringbuffer_consumer_enter(ringbuf);
+
+	read = atomic64_read(&ringbuf->read);
+
+	if (unlikely(ringbuffer_consumer_avail(ringbuf, read, len) != len))
+		ret = -EINVAL;
+	else if (likely(len))
+		ringbuffer_consumer_advance(ringbuf, read, len);
+
+	ringbuffer_consumer_leave(ringbuf, busy);
+
+	return ret;
+}
+
+int ringbuffer_mmap(struct ringbuffer *ringbuf, struct vm_area_struct *vma)
+{
+	int ret = 0;
+	unsigned long addr;
+	unsigned int i;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (!ringbuf->buf ||
+	    vma->vm_end - vma->vm_start != PAGE_SIZE + ringbuf->size)
+		return -EINVAL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#else
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	addr = vma->vm_start;
+
+	ret = vm_insert_page(vma, addr, virt_to_page(ringbuf->ctrl));
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ringbuf->page_num; i++) {
+		addr += PAGE_SIZE;
+
+		ret = vm_insert_page(vma, addr, ringbuf->pages[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void ringbuffer_count_drop(struct ringbuffer *ringbuf, size_t len)
+{
+	atomic64_add(DIV_ROUND_UP(len, RINGBUFFER_PACKET_SIZE),
+		     &ringbuf->producer.dropped_packets);
+	atomic64_add(len, &ringbuf->producer.dropped_bytes);
+}
+
+/*
+ * Frees at least len bytes by discarding the oldest unread packets.
+ * Nothing is dropped while the consumer is copying, it is about to free
+ * some space anyway.
+ */
+static void ringbuffer_drop_oldest(struct ringbuffer *ringbuf,
+				   u64 written, size_t len)
+{
+	u64 read, used;
+	size_t drop;
+	u32 rem;
+
+	if (atomic_cmpxchg_acquire(&ringbuf->consumer.busy, 0, 1))
+		return;
+
+	read = atomic64_read(&ringbuf->read);
+	used = written - read;
+
+	/* leave the consumer on a packet boundary */
+	div_u64_rem(used, RINGBUFFER_PACKET_SIZE, &rem);
+	drop = rem;
+	if (len > drop)
+		drop += roundup(len - drop, RINGBUFFER_PACKET_SIZE);
+	if (drop > used)
+		drop = used;
+
+	ringbuffer_consumer_advance(ringbuf, read, drop);
+	atomic_set_release(&ringbuf->consumer.busy, 0);
+
+	ringbuffer_count_drop(ringbuf, drop);
+
+	ringbuf->producer.read = read + drop;
+	ringbuf->producer.space = ringbuf->size - (written - ringbuf->producer.read);
+}
+
+/*
+ * The writer stores data in batches: ringbuffer_write_begin() starts a batch,
+ * ringbuffer_write_put() copies data without touching anything the consumer
+ * looks at, and ringbuffer_write_commit() publishes everything put so far at
+ * once.
+ */
+int ringbuffer_write_begin(struct ringbuffer *ringbuf)
+{
+	/* ringbuffer_lock() waits for the batch with an RCU grace period */
+	rcu_read_lock();
+
+	if (unlikely(atomic_read(&ringbuf->state) != 2)) {
+		rcu_read_unlock();
 		return -EINVAL;
+	}
+
+	ringbuf->producer.active = true;
+	ringbuf->producer.space = ringbuf->size -
+				  (atomic64_read(&ringbuf->written) -
+				   ringbuf->producer.read);
+	ringbuf->producer.len = 0;
 
-	atomic_add_return_acquire(1, &ringbuf->rw_count);
+	return 0;
+}
+
+int ringbuffer_write_put(struct ringbuffer *ringbuf,
+			 const void *buf, size_t *len)
+{
+	int ret = 0;
+	u8 *p;
+	size_t buf_size, tail, write_size;
+	u64 written;
+
+	if (unlikely(!ringbuf->producer.active)) {
+		*len = 0;
+		return -EINVAL;
+	}
 
 	p = ringbuf->buf;
 	buf_size = ringbuf->size;
-	actual_size = atomic_read_acquire(&ringbuf->actual_size);
-	tail = atomic_read(&ringbuf->tail);
+	tail = ringbuf->producer.tail;
+	written = atomic64_read(&ringbuf->written) + ringbuf->producer.len;
+
+	if (unlikely(*len > ringbuf->producer.space)) {
+		/* refresh the cached consumer position */
+		ringbuf->producer.read = atomic64_read_acquire(&ringbuf->read);
+		ringbuf->producer.space = buf_size -
+					  (written - ringbuf->producer.read);
+
+		if (*len > ringbuf->producer.space &&
+		    READ_ONCE(ringbuf->policy) == PTX_OVERFLOW_DROP_OLDEST)
+			ringbuffer_drop_oldest(ringbuf, written,
+					       *len - ringbuf->producer.space);
+	}
+
+	if (likely(*len <= ringbuf->producer.space)) {
+		write_size = *len;
+	} else {
+		/* drop the newest data, never storing a partial packet */
+		write_size = rounddown(ringbuf->producer.space,
+				       RINGBUFFER_PACKET_SIZE);
+		ringbuffer_count_drop(ringbuf, *len - write_size);
+	}
 
-	write_size = likely(actual_size + *len <= buf_size) ? *len
-							    : (buf_size - actual_size);
 	if (likely(write_size)) {
-		if (likely(tail + write_size <= buf_size)) {
-			memcpy(p + tail, buf, write_size);
-			tail = unlikely(tail + write_size == buf_size) ? 0
-								       : (tail + write_size);
-		} else {
-			size_t tmp = buf_size - tail;
-
-			memcpy(p + tail, buf, tmp);
-			memcpy(p, ((u8 *)buf) + tmp, write_size - tmp);
-			tail = write_size - tmp;
-		}
+		/* tell snooping readers which area is about to be overwritten */
+		atomic64_set(&ringbuf->reserved, written + write_size);
+		smp_wmb();
 
-		atomic_xchg(&ringbuf->tail, tail);
-		atomic_add_return_release(write_size,
-					  &ringbuf->actual_size);
-	}
+		memcpy(p + tail, buf, write_size);
 
-	if (unlikely(!atomic_sub_return(1, &ringbuf->rw_count) &&
-	    atomic_read(&ringbuf->wait_count)))
-		wake_up(&ringbuf->wait);
+		tail += write_size;
+		if (tail >= buf_size)
+			tail -= buf_size;
+
+		ringbuf->producer.tail = tail;
+		ringbuf->producer.space -= write_size;
+		ringbuf->producer.len += write_size;
+	}
 
 	if (unlikely(*len != write_size))
 		ret = -EOVERFLOW;
@@ -277,12 +799,110 @@ int ringbuffer_write_atomic(struct ringbuffer *ringbuf,
 	return ret;
 }
 
+void ringbuffer_write_commit(struct ringbuffer *ringbuf)
+{
+	size_t len = ringbuf->producer.len;
+
+	if (unlikely(!ringbuf->producer.active))
+		return;
+
+	ringbuf->producer.active = false;
+
+	if (likely(len)) {
+		u64 written = atomic64_read(&ringbuf->written) + len;
+		size_t fill;
+
+		atomic64_set_release(&ringbuf->written, written);
+
+		fill = written - atomic64_read(&ringbuf->read);
+		if (unlikely(fill > ringbuf->producer.fill_max))
+			WRITE_ONCE(ringbuf->producer.fill_max, fill);
+
+		WRITE_ONCE(ringbuf->ctrl->tail, ringbuf->producer.tail);
+		smp_store_release(&ringbuf->ctrl->written,
+				  ringbuf->ctrl->written + len);
+	}
+
+	rcu_read_unlock();
+
+	return;
+}
+
+/* stream position of the next byte to be put, for the producer */
+u64 ringbuffer_write_pos(struct ringbuffer *ringbuf)
+{
+	u64 pos = atomic64_read(&ringbuf->written);
+
+	if (ringbuf->producer.active)
+		pos += ringbuf->producer.len;
+
+	return pos;
+}
+
+int ringbuffer_write_atomic(struct ringbuffer *ringbuf,
+			    const void *buf, size_t *len)
+{
+	int ret = 0;
+
+	ret = ringbuffer_write_begin(ringbuf);
+	if (unlikely(ret))
+		return ret;
+
+	ret = ringbuffer_write_put(ringbuf, buf, len);
+	ringbuffer_write_commit(ringbuf);
+
+	return ret;
+}
+
+void ringbuffer_set_overflow_policy(struct ringbuffer *ringbuf,
+				    enum ptx_overflow_policy policy)
+{
+	/* a consumer in progress has not handed its position over */
+	mutex_lock(&ringbuf->consumer.lock);
+	WRITE_ONCE(ringbuf->policy, policy);
+	mutex_unlock(&ringbuf->consumer.lock);
+}
+
+void ringbuffer_get_drop_stats(struct ringbuffer *ringbuf,
+			       u64 *packets, u64 *bytes)
+{
+	*packets = atomic64_read(&ringbuf->producer.dropped_packets);
+	*bytes = atomic64_read(&ringbuf->producer.dropped_bytes);
+}
+
 bool ringbuffer_is_running(struct ringbuffer *ringbuf)
 {
 	return !!atomic_read_acquire(&ringbuf->state);
 }
 
-bool ringbuffer_is_readable(struct ringbuffer *ringbuf)
+size_t ringbuffer_size(struct ringbuffer *ringbuf)
+{
+	return ringbuf->size;
+}
+
+size_t ringbuffer_fill_max(struct ringbuffer *ringbuf)
+{
+	return READ_ONCE(ringbuf->producer.fill_max);
+}
+
+u64 ringbuffer_readable_size(struct ringbuffer *ringbuf)
+{
+	return atomic64_read_acquire(&ringbuf->written) -
+	       atomic64_read(&ringbuf->read);
+}
+
+u64 ringbuffer_snoopable_size(struct ringbuffer *ringbuf, u64 pos)
+{
+	return atomic64_read_acquire(&ringbuf->written) - pos;
+}
+
+u64 ringbuffer_snoop_pos(struct ringbuffer *ringbuf)
+{
+	return atomic64_read_acquire(&ringbuf->written);
+}
+
+/* stream position of the next byte to be read, for the consumer */
+u64 ringbuffer_read_pos(struct ringbuffer *ringbuf)
 {
-	return !!atomic_read_acquire(&ringbuf->actual_size);
+	return atomic64_read(&ringbuf->read);
 }
@@ -10,20 +10,65 @@
 
 #include <linux/types.h>
 #include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
 
+#include "ptx_ioctl.h"
+
+/*
+ * Single producer (the stream handler) and single consumer (the owner of the
+ * tsdev) ring buffer. Each side keeps its own state on its own cache line and
+ * only looks at the other side's free running counter when its cached copy
+ * runs out. A batch of writes is an RCU read-side critical section, so the
+ * producer takes no atomic read-modify-write, and the consumer only shares
+ * its position with the producer when the overflow policy lets the producer
+ * drop the oldest data.
+ *
+ * The data area is made of individually allocated pages which are mapped
+ * twice in a row, so that any range of up to size bytes starting inside the
+ * ring is virtually contiguous.
+ */
 struct ringbuffer {
 	atomic_t state;
-	atomic_t rw_count;
+	atomic_t armed;	// may have been written to since the last grace period
 	atomic_t wait_count;
 	wait_queue_head_t wait;
-	u8 *buf;
+	struct page **pages;
+	unsigned int page_num;
+	u8 *buf;	// pages mapped twice
 	size_t size;
-	atomic_t actual_size;
-	atomic_t head;	// read
-	atomic_t tail;	// write
+	struct ptx_mmap_ctrl *ctrl;
+	enum ptx_overflow_policy policy;	// changed under consumer.lock
+
+	struct {
+		bool active;	// in a batch
+		size_t tail;	// write offset
+		size_t space;	// free space known to the producer
+		size_t len;	// bytes put in the current batch
+		u64 read;	// cached copy of read
+		atomic64_t dropped_packets;
+		atomic64_t dropped_bytes;
+		size_t fill_max;	// high-water mark of the ring fill
+	} producer ____cacheline_aligned_in_smp;
+	atomic64_t written;	// total bytes stored
+	atomic64_t reserved;	// total bytes stored or being stored
+
+	struct {
+		struct mutex lock;	// serializes the consumers
+		atomic_t busy;	// PTX_OVERFLOW_DROP_OLDEST only
+		size_t head;	// read offset
+		u64 written;	// cached copy of written
+	} consumer ____cacheline_aligned_in_smp;
+	atomic64_t read;	// total bytes consumed
+
+	atomic_t snoop_busy ____cacheline_aligned_in_smp;
 };
 
+typedef u32 (*ringbuffer_prefix_t)(void *context, u64 pos);
+
 int ringbuffer_create(struct ringbuffer **ringbuf);
 int ringbuffer_destroy(struct ringbuffer *ringbuf);
 int ringbuffer_alloc(struct ringbuffer *ringbuf, size_t size);
@@ -32,11 +77,35 @@ int ringbuffer_reset(struct ringbuffer *ringbuf);
 int ringbuffer_start(struct ringbuffer *ringbuf);
 int ringbuffer_stop(struct ringbuffer *ringbuf);
 int ringbuffer_ready_read(struct ringbuffer *ringbuf);
-int ringbuffer_read_user(struct ringbuffer *ringbuf,
-			 void __user *buf, size_t *len);
+int ringbuffer_read_iter(struct ringbuffer *ringbuf,
+			 struct iov_iter *iter, size_t *len);
+int ringbuffer_snoop_iter(struct ringbuffer *ringbuf, u64 *pos,
+			  struct iov_iter *iter, size_t *len, u64 *lost);
+int ringbuffer_read_prefixed_iter(struct ringbuffer *ringbuf,
+				  struct iov_iter *iter, size_t *len,
+				  ringbuffer_prefix_t prefix, void *context);
+int ringbuffer_snoop_prefixed_iter(struct ringbuffer *ringbuf, u64 *pos,
+				   struct iov_iter *iter, size_t *len, u64 *lost,
+				   ringbuffer_prefix_t prefix, void *context);
+int ringbuffer_consume(struct ringbuffer *ringbuf, size_t len);
+int ringbuffer_mmap(struct ringbuffer *ringbuf, struct vm_area_struct *vma);
 int ringbuffer_write_atomic(struct ringbuffer *ringbuf,
 			    const void *buf, size_t *len);
-bool ringbuffer_is_readable(struct ringbuffer *ringbuf);
+int ringbuffer_write_begin(struct ringbuffer *ringbuf);
+int ringbuffer_write_put(struct ringbuffer *ringbuf,
+			 const void *buf, size_t *len);
+void ringbuffer_write_commit(struct ringbuffer *ringbuf);
+u64 ringbuffer_write_pos(struct ringbuffer *ringbuf);
+void ringbuffer_set_overflow_policy(struct ringbuffer *ringbuf,
+				    enum ptx_overflow_policy policy);
+void ringbuffer_get_drop_stats(struct ringbuffer *ringbuf,
+			       u64 *packets, u64 *bytes);
+size_t ringbuffer_size(struct ringbuffer *ringbuf);
+size_t ringbuffer_fill_max(struct ringbuffer *ringbuf);
+u64 ringbuffer_readable_size(struct ringbuffer *ringbuf);
+u64 ringbuffer_snoopable_size(struct ringbuffer *ringbuf, u64 pos);
+u64 ringbuffer_snoop_pos(struct ringbuffer *ringbuf);
+u64 ringbuffer_read_pos(struct ringbuffer *ringbuf);
 bool ringbuffer_is_running(struct ringbuffer *ringbuf);
 
 #endif
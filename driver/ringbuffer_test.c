@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the ring buffer (ringbuffer_test.c)
+ */
+
+#include "ringbuffer.c"
+
+#include <linux/ktime.h>
+#include <linux/uio.h>
+
+#include "px4_drv_test.h"
+
+#define RINGBUFFER_TEST_SIZE		PAGE_SIZE
+#define RINGBUFFER_TEST_PACKETS		(RINGBUFFER_TEST_SIZE / RINGBUFFER_PACKET_SIZE)
+#define RINGBUFFER_TEST_BENCH_CHUNK	(RINGBUFFER_PACKET_SIZE * 816)
+
+static struct ringbuffer *ringbuffer_test_create(struct kunit *test,
+						 size_t size,
+						 enum ptx_overflow_policy policy)
+{
+	struct ringbuffer *ringbuf;
+
+	KUNIT_ASSERT_EQ(test, ringbuffer_create(&ringbuf), 0);
+	KUNIT_ASSERT_EQ(test, ringbuffer_alloc(ringbuf, size), 0);
+
+	ringbuffer_set_overflow_policy(ringbuf, policy);
+	ringbuffer_start(ringbuf);
+	ringbuffer_ready_read(ringbuf);
+
+	return ringbuf;
+}
+
+static size_t ringbuffer_test_read(struct ringbuffer *ringbuf,
+				   void *buf, size_t len)
+{
+	struct kvec kv = { .iov_base = buf, .iov_len = len };
+	struct iov_iter iter;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,20,0)
+	iov_iter_kvec(&iter, READ, &kv, 1, len);
+#else
+	iov_iter_kvec(&iter, ITER_KVEC | READ, &kv, 1, len);
+#endif
+
+	if (ringbuffer_read_iter(ringbuf, &iter, &len))
+		return 0;
+
+	return len;
+}
+
+static size_t ringbuffer_test_snoop(struct ringbuffer *ringbuf, u64 *pos,
+				    void *buf, size_t len, u64 *lost)
+{
+	struct kvec kv = { .iov_base = buf, .iov_len = len };
+	struct iov_iter iter;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,20,0)
+	iov_iter_kvec(&iter, READ, &kv, 1, len);
+#else
+	iov_iter_kvec(&iter, ITER_KVEC | READ, &kv, 1, len);
+#endif
+
+	if (ringbuffer_snoop_iter(ringbuf, pos, &iter, &len, lost))
+		return 0;
+
+	return len;
+}
+
+static u32 ringbuffer_test_prefix(void *context, u64 pos)
+{
+	return lower_32_bits(pos);
+}
+
+static u32 ringbuffer_test_prefix_of(const u8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* an M2TS read, from the consumer position when pos is NULL */
+static size_t ringbuffer_test_read_prefixed(struct ringbuffer *ringbuf,
+					    u64 *pos, void *buf, size_t len,
+					    u64 *lost)
+{
+	struct kvec kv = { .iov_base = buf, .iov_len = len };
+	struct iov_iter iter;
+	int ret;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,20,0)
+	iov_iter_kvec(&iter, READ, &kv, 1, len);
+#else
+	iov_iter_kvec(&iter, ITER_KVEC | READ, &kv, 1, len);
+#endif
+
+	if (pos)
+		ret = ringbuffer_snoop_prefixed_iter(ringbuf, pos, &iter, &len,
+						     lost, ringbuffer_test_prefix,
+						     NULL);
+	else
+		ret = ringbuffer_read_prefixed_iter(ringbuf, &iter, &len,
+						    ringbuffer_test_prefix, NULL);
+
+	return (ret) ? 0 : len;
+}
+
+/* odd sized writes and reads which wrap around the end many times */
+static void ringbuffer_test_wrap(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	u64 wpos = 0, rpos = 0;
+	unsigned int i;
+
+	buf = kunit_kmalloc(test, RINGBUFFER_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_NEWEST);
+
+	for (i = 0; i < 1000; i++) {
+		size_t len = RINGBUFFER_PACKET_SIZE * (i % RINGBUFFER_TEST_PACKETS + 1);
+		size_t chunk = 1 + (i * 97) % 1000;
+
+		px4_drv_test_fill(buf, len, wpos);
+		KUNIT_ASSERT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+		wpos += len;
+
+		KUNIT_EXPECT_EQ(test, ringbuffer_readable_size(ringbuf), wpos - rpos);
+
+		while (rpos < wpos) {
+			size_t n = ringbuffer_test_read(ringbuf, buf, chunk);
+
+			KUNIT_ASSERT_NE(test, n, (size_t)0);
+			KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf, n, rpos));
+			rpos += n;
+		}
+	}
+
+	KUNIT_EXPECT_GT(test, wpos, (u64)RINGBUFFER_TEST_SIZE * 100);
+	KUNIT_EXPECT_EQ(test, ringbuffer_readable_size(ringbuf), (u64)0);
+	KUNIT_EXPECT_EQ(test, ringbuffer_read_pos(ringbuf), wpos);
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/* PTX_OVERFLOW_DROP_NEWEST stores whole packets only and counts the rest */
+static void ringbuffer_test_drop_newest(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	size_t len = RINGBUFFER_PACKET_SIZE * (RINGBUFFER_TEST_PACKETS + 9);
+	size_t stored = RINGBUFFER_PACKET_SIZE * RINGBUFFER_TEST_PACKETS;
+	u64 packets, bytes;
+
+	buf = kunit_kmalloc(test, len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_NEWEST);
+
+	px4_drv_test_fill(buf, len, 0);
+	KUNIT_EXPECT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len),
+			-EOVERFLOW);
+	KUNIT_EXPECT_EQ(test, len, stored);
+
+	ringbuffer_get_drop_stats(ringbuf, &packets, &bytes);
+	KUNIT_EXPECT_EQ(test, packets, (u64)9);
+	KUNIT_EXPECT_EQ(test, bytes, (u64)RINGBUFFER_PACKET_SIZE * 9);
+
+	/* the oldest data is kept */
+	memset(buf, 0, stored);
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read(ringbuf, buf, stored), stored);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf, stored, 0));
+
+	/* and the space is usable again once read */
+	len = RINGBUFFER_PACKET_SIZE;
+	KUNIT_EXPECT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+	KUNIT_EXPECT_EQ(test, len, (size_t)RINGBUFFER_PACKET_SIZE);
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/* PTX_OVERFLOW_DROP_OLDEST makes room by discarding the oldest packets */
+static void ringbuffer_test_drop_oldest(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	size_t len, stored = RINGBUFFER_PACKET_SIZE * RINGBUFFER_TEST_PACKETS;
+	unsigned int i, num = RINGBUFFER_TEST_PACKETS + 9;
+	u64 packets, bytes;
+
+	buf = kunit_kmalloc(test, RINGBUFFER_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_OLDEST);
+
+	for (i = 0; i < num; i++) {
+		len = RINGBUFFER_PACKET_SIZE;
+		px4_drv_test_fill(buf, len, (u64)RINGBUFFER_PACKET_SIZE * i);
+		KUNIT_EXPECT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+		KUNIT_EXPECT_EQ(test, len, (size_t)RINGBUFFER_PACKET_SIZE);
+	}
+
+	ringbuffer_get_drop_stats(ringbuf, &packets, &bytes);
+	KUNIT_EXPECT_EQ(test, packets, (u64)9);
+	KUNIT_EXPECT_EQ(test, bytes, (u64)RINGBUFFER_PACKET_SIZE * 9);
+	KUNIT_EXPECT_EQ(test, ringbuffer_readable_size(ringbuf), (u64)stored);
+	KUNIT_EXPECT_EQ(test, ringbuffer_read_pos(ringbuf),
+			(u64)RINGBUFFER_PACKET_SIZE * 9);
+
+	/* the newest packets are kept, starting on a packet boundary */
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read(ringbuf, buf, stored), stored);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf, stored,
+						   (u64)RINGBUFFER_PACKET_SIZE * 9));
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/* a snooping reader which has been lapped is told how much it has lost */
+static void ringbuffer_test_snoop_lost(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	size_t len, stored = RINGBUFFER_PACKET_SIZE * RINGBUFFER_TEST_PACKETS;
+	u64 pos, lost = 0, wpos = 0;
+	size_t skip;
+	unsigned int i;
+
+	buf = kunit_kmalloc(test, RINGBUFFER_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_NEWEST);
+
+	pos = ringbuffer_snoop_pos(ringbuf);
+
+	/* the owner keeps up, the snooping reader doesn't read at all */
+	for (i = 0; i < RINGBUFFER_TEST_PACKETS * 2; i++) {
+		len = RINGBUFFER_PACKET_SIZE;
+		px4_drv_test_fill(buf, len, wpos);
+		KUNIT_ASSERT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+		wpos += len;
+
+		KUNIT_ASSERT_EQ(test, ringbuffer_test_read(ringbuf, buf, len), len);
+	}
+
+	/* skipped to the oldest whole packet still in the ring */
+	skip = roundup((size_t)(wpos - RINGBUFFER_TEST_SIZE),
+		       RINGBUFFER_PACKET_SIZE);
+
+	len = ringbuffer_test_snoop(ringbuf, &pos, buf, RINGBUFFER_TEST_SIZE, &lost);
+	KUNIT_EXPECT_EQ(test, lost, (u64)skip);
+	KUNIT_EXPECT_EQ(test, (u64)len, wpos - skip);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf, len, skip));
+	KUNIT_EXPECT_EQ(test, pos, wpos);
+
+	/* the writer reserves the area being copied before it's published */
+	pos = wpos - stored;
+	lost = 0;
+
+	KUNIT_ASSERT_EQ(test, ringbuffer_write_begin(ringbuf), 0);
+
+	len = RINGBUFFER_PACKET_SIZE;
+	px4_drv_test_fill(buf, len, wpos);
+	KUNIT_EXPECT_EQ(test, ringbuffer_write_put(ringbuf, buf, &len), 0);
+
+	len = ringbuffer_test_snoop(ringbuf, &pos, buf, stored, &lost);
+
+	ringbuffer_write_commit(ringbuf);
+
+	KUNIT_EXPECT_EQ(test, len, stored);
+	KUNIT_EXPECT_EQ(test, lost,
+			(u64)(stored + RINGBUFFER_PACKET_SIZE - RINGBUFFER_TEST_SIZE));
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/*
+ * While read-only readers are attached, the tsdev arms the ring buffer and
+ * drops the owner's oldest data, so a snooping reader keeps up with the
+ * writer even though the owner never reads.
+ */
+static void ringbuffer_test_owner_idle(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	size_t len, stored = RINGBUFFER_PACKET_SIZE * RINGBUFFER_TEST_PACKETS;
+	u64 pos, lost = 0, wpos = 0, packets, bytes;
+	unsigned int i, num = RINGBUFFER_TEST_PACKETS * 4;
+
+	buf = kunit_kmalloc(test, RINGBUFFER_PACKET_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_OLDEST);
+
+	pos = ringbuffer_snoop_pos(ringbuf);
+
+	for (i = 0; i < num; i++) {
+		len = RINGBUFFER_PACKET_SIZE;
+		px4_drv_test_fill(buf, len, wpos);
+		KUNIT_EXPECT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+		KUNIT_EXPECT_EQ(test, len, (size_t)RINGBUFFER_PACKET_SIZE);
+		wpos += len;
+
+		memset(buf, 0, RINGBUFFER_PACKET_SIZE);
+		len = ringbuffer_test_snoop(ringbuf, &pos, buf,
+					    RINGBUFFER_PACKET_SIZE, &lost);
+		KUNIT_EXPECT_EQ(test, len, (size_t)RINGBUFFER_PACKET_SIZE);
+		KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf, len, wpos - len));
+	}
+
+	KUNIT_EXPECT_EQ(test, lost, (u64)0);
+	KUNIT_EXPECT_EQ(test, pos, wpos);
+
+	/* only the owner has lost anything, and it still has the newest data */
+	ringbuffer_get_drop_stats(ringbuf, &packets, &bytes);
+	KUNIT_EXPECT_EQ(test, packets, (u64)(num - RINGBUFFER_TEST_PACKETS));
+	KUNIT_EXPECT_EQ(test, ringbuffer_readable_size(ringbuf), (u64)stored);
+	KUNIT_EXPECT_EQ(test, ringbuffer_read_pos(ringbuf), wpos - stored);
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/*
+ * An M2TS read after a plain read which stopped in the middle of a packet
+ * resumes on the next packet boundary, and never leaves a position past
+ * what has been written.
+ */
+static void ringbuffer_test_prefixed_realign(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *buf;
+	size_t len, m2ts_len = 4 + RINGBUFFER_PACKET_SIZE;
+	u64 pos = 50, lost = 0;
+
+	buf = kunit_kmalloc(test, RINGBUFFER_PACKET_SIZE * 2, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ringbuf = ringbuffer_test_create(test, RINGBUFFER_TEST_SIZE,
+					 PTX_OVERFLOW_DROP_NEWEST);
+
+	/* only a part of the first packet has been written */
+	len = 100;
+	px4_drv_test_fill(buf, len, 0);
+	KUNIT_ASSERT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+	KUNIT_ASSERT_EQ(test, ringbuffer_test_read(ringbuf, buf, 50), (size_t)50);
+
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read_prefixed(ringbuf, NULL, buf,
+							    m2ts_len, &lost),
+			(size_t)0);
+	KUNIT_EXPECT_EQ(test, ringbuffer_readable_size(ringbuf), (u64)0);
+
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read_prefixed(ringbuf, &pos, buf,
+							    m2ts_len, &lost),
+			(size_t)0);
+	KUNIT_EXPECT_EQ(test, pos, (u64)100);
+	KUNIT_EXPECT_EQ(test, ringbuffer_snoopable_size(ringbuf, pos), (u64)0);
+
+	/* the rest of it and one more packet */
+	len = RINGBUFFER_PACKET_SIZE * 2 - 100;
+	px4_drv_test_fill(buf, len, 100);
+	KUNIT_ASSERT_EQ(test, ringbuffer_write_atomic(ringbuf, buf, &len), 0);
+
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read_prefixed(ringbuf, NULL, buf,
+							    m2ts_len, &lost),
+			m2ts_len);
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_prefix_of(buf), (u32)RINGBUFFER_PACKET_SIZE);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf + 4, RINGBUFFER_PACKET_SIZE,
+						   RINGBUFFER_PACKET_SIZE));
+
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_read_prefixed(ringbuf, &pos, buf,
+							    m2ts_len, &lost),
+			m2ts_len);
+	KUNIT_EXPECT_EQ(test, ringbuffer_test_prefix_of(buf), (u32)RINGBUFFER_PACKET_SIZE);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(buf + 4, RINGBUFFER_PACKET_SIZE,
+						   RINGBUFFER_PACKET_SIZE));
+	KUNIT_EXPECT_EQ(test, pos, (u64)RINGBUFFER_PACKET_SIZE * 2);
+	KUNIT_EXPECT_EQ(test, lost, (u64)0);
+
+	ringbuffer_destroy(ringbuf);
+}
+
+/*
+ * Throughput of one producer and one consumer taking turns, against two
+ * plain memcpy() calls moving the same data.
+ */
+static void ringbuffer_test_bench(struct kunit *test)
+{
+	struct ringbuffer *ringbuf;
+	u8 *src, *dst, *ref;
+	size_t chunk = RINGBUFFER_TEST_BENCH_CHUNK;
+	u64 total = 0, offered = 0, stored = 0, start, ns;
+
+	src = kunit_kmalloc(test, chunk, GFP_KERNEL);
+	dst = kunit_kmalloc(test, chunk, GFP_KERNEL);
+	ref = kunit_kmalloc(test, chunk, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ref);
+
+	ringbuf = ringbuffer_test_create(test, chunk * 8,
+					 PTX_OVERFLOW_DROP_NEWEST);
+
+	px4_drv_test_fill(src, chunk, 0);
+
+	start = ktime_get_ns();
+
+	while (total < PX4_DRV_TEST_BENCH_SIZE) {
+		size_t len = chunk;
+
+		ringbuffer_write_begin(ringbuf);
+		ringbuffer_write_put(ringbuf, src, &len);
+		ringbuffer_write_commit(ringbuf);
+		offered += chunk;
+		stored += len;
+
+		total += ringbuffer_test_read(ringbuf, dst, chunk);
+	}
+
+	ns = ktime_get_ns() - start;
+
+	/* nothing has been dropped, and everything has been read */
+	KUNIT_EXPECT_EQ(test, stored, offered);
+	KUNIT_EXPECT_EQ(test, total, stored);
+	KUNIT_EXPECT_TRUE(test, px4_drv_test_check(dst, chunk, 0));
+	px4_drv_test_report(test, "ringbuffer write/read", total, ns);
+
+	total = 0;
+	start = ktime_get_ns();
+
+	while (total < PX4_DRV_TEST_BENCH_SIZE) {
+		memcpy(ref, src, chunk);
+		memcpy(dst, ref, chunk);
+		total += chunk;
+	}
+
+	ns = ktime_get_ns() - start;
+
+	px4_drv_test_report(test, "memcpy x2 (reference)", total, ns);
+
+	ringbuffer_destroy(ringbuf);
+}
+
+static struct kunit_case ringbuffer_test_cases[] = {
+	KUNIT_CASE(ringbuffer_test_wrap),
+	KUNIT_CASE(ringbuffer_test_drop_newest),
+	KUNIT_CASE(ringbuffer_test_drop_oldest),
+	KUNIT_CASE(ringbuffer_test_snoop_lost),
+	KUNIT_CASE(ringbuffer_test_owner_idle),
+	KUNIT_CASE(ringbuffer_test_prefixed_realign),
+	KUNIT_CASE(ringbuffer_test_bench),
+	{}
+};
+
+struct kunit_suite ringbuffer_test_suite = {
+	.name = "px4_drv_ringbuffer",
+	.test_cases = ringbuffer_test_cases,
+};
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * TS demultiplexer (ts_demux.c)
+ *
+ * Splits the stream received from the bridge into packets and hands them
+ * to the stream owners. Shared by all device families.
+ */
+
+#include "ts_demux.h"
+#include "ts_sync.h"
+
+#ifdef __linux__
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "ts_demux_trace.h"
+#else
+#define trace_ts_demux_put(demux, id, len)
+#define trace_ts_demux_resync(demux, remain)
+#endif
+
+void ts_demux_init(struct ts_demux *demux, enum ts_demux_format format,
+		   int stream_num, ts_demux_put_t put, void *context)
+{
+	demux->format = format;
+	demux->stream_num = (format == TS_DEMUX_FORMAT_TAGGED) ? stream_num : 1;
+	demux->put = put;
+	demux->context = context;
+	memset(&demux->stats, 0, sizeof(demux->stats));
+	demux->sync_lost = false;
+	demux->remain_len = 0;
+}
+
+void ts_demux_reset(struct ts_demux *demux)
+{
+	demux->sync_lost = false;
+	demux->remain_len = 0;
+}
+
+static inline void ts_demux_resync(struct ts_demux *demux,
+				   u8 **p, u32 *remain, u8 mask, u8 value)
+{
+	/* count each loss once, not each sync byte candidate tried */
+	if (!demux->sync_lost) {
+		demux->sync_lost = true;
+		demux->stats.resync++;
+		trace_ts_demux_resync(demux, *remain);
+	}
+
+	ts_sync_skip(p, remain, mask, value);
+}
+
+static inline void ts_demux_put(struct ts_demux *demux,
+				int id, u8 *buf, u32 len)
+{
+	trace_ts_demux_put(demux, id, len);
+	demux->put(demux->context, id, buf, len);
+}
+
+static void ts_demux_process_tagged(struct ts_demux *demux,
+				    u8 **buf, u32 *len)
+{
+	u8 *p = *buf;
+	u32 remain = *len;
+
+	while (likely(remain)) {
+		u32 i;
+		bool sync_remain = false;
+		u8 *run = NULL, run_id = 0;
+
+		for (i = 0; i < TS_DEMUX_SYNC_COUNT; i++) {
+			if (likely(((i + 1) * 188) <= remain)) {
+				if (unlikely((p[i * 188] & 0x8f) != 0x07))
+					break;
+			} else {
+				sync_remain = true;
+				break;
+			}
+		}
+
+		if (unlikely(sync_remain))
+			break;
+
+		if (unlikely(i < TS_DEMUX_SYNC_COUNT)) {
+			ts_demux_resync(demux, &p, &remain, 0x8f, 0x07);
+			continue;
+		}
+
+		demux->sync_lost = false;
+
+		while (likely(remain >= 188 && ((p[0] & 0x8f) == 0x07))) {
+			u8 id = (p[0] & 0x70) >> 4;
+
+			if (unlikely(id != run_id)) {
+				if (run)
+					ts_demux_put(demux, run_id - 1,
+						     run, (u32)(p - run));
+
+				run = NULL;
+				run_id = id;
+			}
+
+			if (likely(id && id <= demux->stream_num)) {
+				p[0] = 0x47;
+				if (!run)
+					run = p;
+			} else {
+				demux->stats.invalid_id++;
+			}
+
+			p += 188;
+			remain -= 188;
+		}
+
+		if (run)
+			ts_demux_put(demux, run_id - 1, run, (u32)(p - run));
+	}
+
+	*buf = p;
+	*len = remain;
+
+	return;
+}
+
+static void ts_demux_process_plain(struct ts_demux *demux,
+				   u8 **buf, u32 *len)
+{
+	u8 *p = *buf;
+	u32 remain = *len;
+
+	while (likely(remain)) {
+		u32 i = 0;
+		bool sync_remain = false;
+
+		while (true) {
+			if (likely(((i + 1) * 188) <= remain)) {
+				if (unlikely(p[i * 188] != 0x47))
+					break;
+			} else {
+				sync_remain = true;
+				break;
+			}
+			i++;
+		}
+
+		if (unlikely(i < TS_DEMUX_SYNC_COUNT)) {
+			/* too short to tell, wait for the rest */
+			if (sync_remain)
+				break;
+
+			ts_demux_resync(demux, &p, &remain, 0xff, 0x47);
+			continue;
+		}
+
+		demux->sync_lost = false;
+
+		ts_demux_put(demux, 0, p, 188 * i);
+
+		p += 188 * i;
+		remain -= 188 * i;
+
+		if (unlikely(sync_remain))
+			break;
+	}
+
+	*buf = p;
+	*len = remain;
+
+	return;
+}
+
+static void ts_demux_process_buf(struct ts_demux *demux, u8 **buf, u32 *len)
+{
+	if (demux->format == TS_DEMUX_FORMAT_TAGGED)
+		ts_demux_process_tagged(demux, buf, len);
+	else
+		ts_demux_process_plain(demux, buf, len);
+}
+
+void ts_demux_process(struct ts_demux *demux, void *buf, u32 len)
+{
+	u8 *ctx_remain_buf = demux->remain_buf;
+	u32 ctx_remain_len = demux->remain_len;
+	u8 *p = buf;
+	u32 remain = len;
+
+	/*
+	 * Feed the bytes left from the last call through remain_buf until
+	 * what is left of it can be resumed from the new buffer.
+	 */
+	while (unlikely(ctx_remain_len)) {
+		u8 *q = ctx_remain_buf;
+		u32 t;
+
+		if (unlikely((ctx_remain_len + remain) < TS_DEMUX_SYNC_SIZE)) {
+			memcpy(ctx_remain_buf + ctx_remain_len, p, remain);
+			demux->remain_len = ctx_remain_len + remain;
+
+			return;
+		}
+
+		t = TS_DEMUX_SYNC_SIZE - ctx_remain_len;
+
+		memcpy(ctx_remain_buf + ctx_remain_len, p, t);
+		p += t;
+		remain -= t;
+		ctx_remain_len = TS_DEMUX_SYNC_SIZE;
+
+		ts_demux_process_buf(demux, &q, &ctx_remain_len);
+
+		if (ctx_remain_len <= t) {
+			/* the rest is all in the new buffer */
+			p -= ctx_remain_len;
+			remain += ctx_remain_len;
+			ctx_remain_len = 0;
+		} else {
+			memmove(ctx_remain_buf, q, ctx_remain_len);
+		}
+	}
+
+	demux->remain_len = 0;
+
+	ts_demux_process_buf(demux, &p, &remain);
+
+	if (unlikely(remain)) {
+		memcpy(demux->remain_buf, p, remain);
+		demux->remain_len = remain;
+	}
+
+	return;
+}
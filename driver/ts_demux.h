@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * TS demultiplexer definitions (ts_demux.h)
+ */
+
+#ifndef __TS_DEMUX_H__
+#define __TS_DEMUX_H__
+
+#ifdef __linux__
+#include <linux/types.h>
+#elif defined(_WIN32) || defined(_WIN64)
+#include "misc_win.h"
+#endif
+
+#define TS_DEMUX_SYNC_COUNT	4
+#define TS_DEMUX_SYNC_SIZE	(188 * TS_DEMUX_SYNC_COUNT)
+
+enum ts_demux_format {
+	TS_DEMUX_FORMAT_PLAIN = 0,	// sync byte 0x47, single stream
+	TS_DEMUX_FORMAT_TAGGED		// (sync & 0x8f) == 0x07, stream id in bit 4-6
+};
+
+// called for each run of consecutive packets of the same stream (id: 0-based)
+typedef void (*ts_demux_put_t)(void *context, int id, u8 *buf, u32 len);
+
+// updated by the stream handler only, read without locking
+struct ts_demux_stats {
+	u64 resync;		// sync losses
+	u64 invalid_id;		// packets with no valid stream id (tagged only)
+};
+
+struct ts_demux {
+	enum ts_demux_format format;
+	int stream_num;
+	ts_demux_put_t put;
+	void *context;
+	struct ts_demux_stats stats;
+	bool sync_lost;		// searching for sync since the last resync counted
+	u32 remain_len;
+	u8 remain_buf[TS_DEMUX_SYNC_SIZE];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void ts_demux_init(struct ts_demux *demux, enum ts_demux_format format,
+		   int stream_num, ts_demux_put_t put, void *context);
+void ts_demux_reset(struct ts_demux *demux);
+void ts_demux_process(struct ts_demux *demux, void *buf, u32 len);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,372 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the TS demultiplexer (ts_demux_test.c)
+ */
+
+/* the tracepoints of the core are registered by px4_drv, not by the tests */
+#define NOTRACE
+
+#include "ts_demux.c"
+
+#include <linux/slab.h>
+#include <linux/ktime.h>
+
+#include "px4_drv_test.h"
+
+#define TS_DEMUX_TEST_PACKETS		100
+#define TS_DEMUX_TEST_STREAMS		4
+#define TS_DEMUX_TEST_GARBAGE		100
+#define TS_DEMUX_TEST_BENCH_CHUNK	(188 * 816)
+
+struct ts_demux_test_context {
+	struct kunit *test;
+	u8 *out[TS_DEMUX_TEST_STREAMS];
+	u32 out_len[TS_DEMUX_TEST_STREAMS];
+	u32 out_size;
+	u64 bytes;
+};
+
+/* chunk sizes to split the input at, aligned to packets or not */
+static const u32 ts_demux_test_chunks[] = {
+	1, 7, 187, 188, 189, 376, 500, 751, 752, 753, 1000, 188 * 10, 188 * 816
+};
+
+/* packet n carries n in the place of the PID */
+static u32 ts_demux_test_packet_num(const u8 *p)
+{
+	return (p[1] << 8) | p[2];
+}
+
+static u8 ts_demux_test_plain_sync(u32 n)
+{
+	return 0x47;
+}
+
+/* runs of 3 packets for each stream id, id 0 is invalid */
+static u8 ts_demux_test_tagged_id(u32 n)
+{
+	return (n / 3) % (TS_DEMUX_TEST_STREAMS + 1);
+}
+
+static u8 ts_demux_test_tagged_sync(u32 n)
+{
+	return (ts_demux_test_tagged_id(n) << 4) | 0x07;
+}
+
+static void ts_demux_test_make(u8 *buf, u32 num, u8 (*sync)(u32 n))
+{
+	u32 n;
+
+	for (n = 0; n < num; n++, buf += 188) {
+		px4_drv_test_fill(buf, 188, (u64)n * 188);
+		buf[0] = sync(n);
+		buf[1] = (n >> 8) & 0xff;
+		buf[2] = n & 0xff;
+	}
+}
+
+static void ts_demux_test_put(void *context, int id, u8 *buf, u32 len)
+{
+	struct ts_demux_test_context *ctx = context;
+	struct kunit *test = ctx->test;
+
+	KUNIT_EXPECT_EQ(test, len % 188, (u32)0);
+
+	if (id < 0 || id >= TS_DEMUX_TEST_STREAMS ||
+	    ctx->out_len[id] + len > ctx->out_size) {
+		KUNIT_EXPECT_TRUE_MSG(test, false, "bad put (id: %d, len: %u)",
+				      id, len);
+		return;
+	}
+
+	memcpy(ctx->out[id] + ctx->out_len[id], buf, len);
+	ctx->out_len[id] += len;
+}
+
+static void ts_demux_test_count(void *context, int id, u8 *buf, u32 len)
+{
+	struct ts_demux_test_context *ctx = context;
+
+	ctx->bytes += len;
+}
+
+static struct ts_demux_test_context *ts_demux_test_alloc(struct kunit *test)
+{
+	struct ts_demux_test_context *ctx;
+	int i;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+
+	ctx->test = test;
+	ctx->out_size = 188 * TS_DEMUX_TEST_PACKETS;
+
+	for (i = 0; i < TS_DEMUX_TEST_STREAMS; i++) {
+		ctx->out[i] = kunit_kmalloc(test, ctx->out_size, GFP_KERNEL);
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->out[i]);
+	}
+
+	return ctx;
+}
+
+/* feeds len bytes of src in pieces of chunk bytes, from a scratch copy */
+static void ts_demux_test_feed(struct ts_demux *demux, u8 *scratch,
+			       const u8 *src, u32 len, u32 chunk)
+{
+	u32 pos;
+
+	memcpy(scratch, src, len);
+
+	for (pos = 0; pos < len; pos += chunk)
+		ts_demux_process(demux, scratch + pos, min(chunk, len - pos));
+}
+
+/*
+ * Checks that the output of a stream is made of whole input packets in
+ * their original order, with the sync byte restored, and returns how many
+ * there are. All of them are expected from first on when strict is set.
+ */
+static u32 ts_demux_test_verify(struct kunit *test, const u8 *out, u32 len,
+				u32 first, bool strict)
+{
+	u32 num = 0, next = first;
+
+	for (; len >= 188; out += 188, len -= 188, num++) {
+		u32 n = ts_demux_test_packet_num(out);
+
+		KUNIT_EXPECT_EQ(test, out[0], (u8)0x47);
+
+		if (strict)
+			KUNIT_EXPECT_EQ(test, n, next);
+		else
+			KUNIT_EXPECT_GE(test, n, next);
+
+		KUNIT_EXPECT_TRUE(test, px4_drv_test_check(&out[3], 185,
+							   (u64)n * 188 + 3));
+		next = n + 1;
+	}
+
+	return num;
+}
+
+static void ts_demux_test_plain(struct kunit *test)
+{
+	struct ts_demux_test_context *ctx = ts_demux_test_alloc(test);
+	struct ts_demux demux;
+	u32 len = 188 * TS_DEMUX_TEST_PACKETS;
+	u8 *src, *scratch;
+	int i;
+
+	src = kunit_kmalloc(test, len, GFP_KERNEL);
+	scratch = kunit_kmalloc(test, len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, scratch);
+
+	ts_demux_test_make(src, TS_DEMUX_TEST_PACKETS, ts_demux_test_plain_sync);
+
+	for (i = 0; i < ARRAY_SIZE(ts_demux_test_chunks); i++) {
+		u32 num;
+
+		ts_demux_init(&demux, TS_DEMUX_FORMAT_PLAIN, 1,
+			      ts_demux_test_put, ctx);
+		ctx->out_len[0] = 0;
+
+		ts_demux_test_feed(&demux, scratch, src, len,
+				   ts_demux_test_chunks[i]);
+
+		/* the last packets may wait in remain_buf for more data */
+		num = ts_demux_test_verify(test, ctx->out[0], ctx->out_len[0],
+					   0, true);
+		KUNIT_EXPECT_EQ(test, demux.remain_len % 188, (u32)0);
+		KUNIT_EXPECT_EQ(test, num + demux.remain_len / 188,
+				(u32)TS_DEMUX_TEST_PACKETS);
+		KUNIT_EXPECT_EQ(test, demux.stats.resync, (u64)0);
+	}
+}
+
+static void ts_demux_test_plain_resync(struct kunit *test)
+{
+	struct ts_demux_test_context *ctx = ts_demux_test_alloc(test);
+	struct ts_demux demux;
+	u32 len = TS_DEMUX_TEST_GARBAGE + 188 * TS_DEMUX_TEST_PACKETS;
+	u8 *src, *scratch;
+	int i;
+
+	src = kunit_kmalloc(test, len, GFP_KERNEL);
+	scratch = kunit_kmalloc(test, len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, scratch);
+
+	/* starts in the middle of a packet, and loses one sync byte later */
+	memset(src, 0x47, TS_DEMUX_TEST_GARBAGE);
+	ts_demux_test_make(src + TS_DEMUX_TEST_GARBAGE, TS_DEMUX_TEST_PACKETS,
+			   ts_demux_test_plain_sync);
+	src[TS_DEMUX_TEST_GARBAGE + 188 * 50] = 0x00;
+
+	for (i = 0; i < ARRAY_SIZE(ts_demux_test_chunks); i++) {
+		u32 num;
+
+		ts_demux_init(&demux, TS_DEMUX_FORMAT_PLAIN, 1,
+			      ts_demux_test_put, ctx);
+		ctx->out_len[0] = 0;
+
+		ts_demux_test_feed(&demux, scratch, src, len,
+				   ts_demux_test_chunks[i]);
+
+		/* up to 3 packets before the broken one go along with it */
+		num = ts_demux_test_verify(test, ctx->out[0], ctx->out_len[0],
+					   0, false);
+		KUNIT_EXPECT_GE(test, num + demux.remain_len / 188,
+				(u32)TS_DEMUX_TEST_PACKETS - 4);
+		KUNIT_EXPECT_EQ(test, demux.stats.resync, (u64)2);
+	}
+}
+
+static void ts_demux_test_tagged(struct kunit *test)
+{
+	struct ts_demux_test_context *ctx = ts_demux_test_alloc(test);
+	struct ts_demux demux;
+	u32 len = 188 * TS_DEMUX_TEST_PACKETS;
+	u8 *src, *scratch;
+	int i, id;
+
+	src = kunit_kmalloc(test, len, GFP_KERNEL);
+	scratch = kunit_kmalloc(test, len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, scratch);
+
+	ts_demux_test_make(src, TS_DEMUX_TEST_PACKETS, ts_demux_test_tagged_sync);
+
+	for (i = 0; i < ARRAY_SIZE(ts_demux_test_chunks); i++) {
+		u32 n, num = 0, done, invalid = 0;
+
+		ts_demux_init(&demux, TS_DEMUX_FORMAT_TAGGED,
+			      TS_DEMUX_TEST_STREAMS, ts_demux_test_put, ctx);
+		memset(ctx->out_len, 0, sizeof(ctx->out_len));
+
+		ts_demux_test_feed(&demux, scratch, src, len,
+				   ts_demux_test_chunks[i]);
+
+		KUNIT_EXPECT_EQ(test, demux.remain_len % 188, (u32)0);
+		done = TS_DEMUX_TEST_PACKETS - demux.remain_len / 188;
+
+		for (id = 0; id < TS_DEMUX_TEST_STREAMS; id++) {
+			const u8 *out = ctx->out[id];
+			u32 out_len = ctx->out_len[id];
+
+			num += ts_demux_test_verify(test, out, out_len, 0, false);
+
+			/* each stream gets only its own packets */
+			for (; out_len; out += 188, out_len -= 188)
+				KUNIT_EXPECT_EQ(test,
+						ts_demux_test_tagged_id(ts_demux_test_packet_num(out)),
+						(u8)(id + 1));
+		}
+
+		for (n = 0; n < done; n++) {
+			if (!ts_demux_test_tagged_id(n))
+				invalid++;
+		}
+
+		KUNIT_EXPECT_EQ(test, num + invalid, done);
+		KUNIT_EXPECT_EQ(test, demux.stats.invalid_id, (u64)invalid);
+		KUNIT_EXPECT_EQ(test, demux.stats.resync, (u64)0);
+	}
+}
+
+static void ts_demux_test_tagged_resync(struct kunit *test)
+{
+	struct ts_demux_test_context *ctx = ts_demux_test_alloc(test);
+	struct ts_demux demux;
+	u32 len = TS_DEMUX_TEST_GARBAGE + 188 * TS_DEMUX_TEST_PACKETS;
+	u8 *src, *scratch;
+	int i, id;
+
+	src = kunit_kmalloc(test, len, GFP_KERNEL);
+	scratch = kunit_kmalloc(test, len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, scratch);
+
+	memset(src, 0x17, TS_DEMUX_TEST_GARBAGE);
+	ts_demux_test_make(src + TS_DEMUX_TEST_GARBAGE, TS_DEMUX_TEST_PACKETS,
+			   ts_demux_test_tagged_sync);
+	src[TS_DEMUX_TEST_GARBAGE + 188 * 50] = 0x00;
+
+	for (i = 0; i < ARRAY_SIZE(ts_demux_test_chunks); i++) {
+		ts_demux_init(&demux, TS_DEMUX_FORMAT_TAGGED,
+			      TS_DEMUX_TEST_STREAMS, ts_demux_test_put, ctx);
+		memset(ctx->out_len, 0, sizeof(ctx->out_len));
+
+		ts_demux_test_feed(&demux, scratch, src, len,
+				   ts_demux_test_chunks[i]);
+
+		for (id = 0; id < TS_DEMUX_TEST_STREAMS; id++)
+			ts_demux_test_verify(test, ctx->out[id], ctx->out_len[id],
+					     0, false);
+
+		KUNIT_EXPECT_EQ(test, demux.stats.resync, (u64)2);
+	}
+}
+
+static void ts_demux_test_bench_format(struct kunit *test,
+				       enum ts_demux_format format,
+				       const char *name)
+{
+	struct ts_demux_test_context *ctx;
+	struct ts_demux demux;
+	u32 chunk = TS_DEMUX_TEST_BENCH_CHUNK;
+	u64 total = 0, ns = 0;
+	u8 *src, *buf;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	src = kunit_kmalloc(test, chunk, GFP_KERNEL);
+	buf = kunit_kmalloc(test, chunk, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+	ts_demux_test_make(src, chunk / 188,
+			   (format == TS_DEMUX_FORMAT_TAGGED) ? ts_demux_test_tagged_sync
+							      : ts_demux_test_plain_sync);
+	ts_demux_init(&demux, format, TS_DEMUX_TEST_STREAMS,
+		      ts_demux_test_count, ctx);
+
+	while (total < PX4_DRV_TEST_BENCH_SIZE) {
+		u64 start;
+
+		/* the tagged format rewrites the sync bytes in place */
+		memcpy(buf, src, chunk);
+
+		start = ktime_get_ns();
+		ts_demux_process(&demux, buf, chunk);
+		ns += ktime_get_ns() - start;
+
+		total += chunk;
+	}
+
+	KUNIT_EXPECT_EQ(test, demux.stats.resync, (u64)0);
+	KUNIT_EXPECT_GT(test, ctx->bytes, (u64)0);
+	px4_drv_test_report(test, name, total, ns);
+}
+
+static void ts_demux_test_bench(struct kunit *test)
+{
+	ts_demux_test_bench_format(test, TS_DEMUX_FORMAT_PLAIN,
+				   "ts_demux plain");
+	ts_demux_test_bench_format(test, TS_DEMUX_FORMAT_TAGGED,
+				   "ts_demux tagged");
+}
+
+static struct kunit_case ts_demux_test_cases[] = {
+	KUNIT_CASE(ts_demux_test_plain),
+	KUNIT_CASE(ts_demux_test_plain_resync),
+	KUNIT_CASE(ts_demux_test_tagged),
+	KUNIT_CASE(ts_demux_test_tagged_resync),
+	KUNIT_CASE(ts_demux_test_bench),
+	{}
+};
+
+struct kunit_suite ts_demux_test_suite = {
+	.name = "px4_drv_ts_demux",
+	.test_cases = ts_demux_test_cases,
+};
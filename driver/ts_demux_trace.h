@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Tracepoints for the TS demultiplexer (ts_demux_trace.h)
+ *
+ * Kept apart from ptx_trace.h so that the demux core only depends on the
+ * tracepoint header. Instantiated in ptx_chrdev.c.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM px4_drv
+
+#if !defined(__TS_DEMUX_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __TS_DEMUX_TRACE_H__
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ts_demux_put,
+	TP_PROTO(const void *demux, int id, u32 len),
+	TP_ARGS(demux, id, len),
+	TP_STRUCT__entry(
+		__field(const void *, demux)
+		__field(int, id)
+		__field(u32, packets)
+	),
+	TP_fast_assign(
+		__entry->demux = demux;
+		__entry->id = id;
+		__entry->packets = len / 188;
+	),
+	TP_printk("demux=%p id=%d packets=%u",
+		  __entry->demux, __entry->id, __entry->packets)
+);
+
+TRACE_EVENT(ts_demux_resync,
+	TP_PROTO(const void *demux, u32 remain),
+	TP_ARGS(demux, remain),
+	TP_STRUCT__entry(
+		__field(const void *, demux)
+		__field(u32, remain)
+	),
+	TP_fast_assign(
+		__entry->demux = demux;
+		__entry->remain = remain;
+	),
+	TP_printk("demux=%p remain=%u", __entry->demux, __entry->remain)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ts_demux_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * TS sync byte search (ts_sync.h)
+ */
+
+#ifndef __TS_SYNC_H__
+#define __TS_SYNC_H__
+
+#ifdef __linux__
+#include <linux/types.h>
+#include <linux/compiler.h>
+#elif defined(_WIN32) || defined(_WIN64)
+#include "misc_win.h"
+#endif
+
+#define TS_SYNC_REPEAT_BYTE(x)	((~0UL / 0xff) * (x))
+
+/*
+ * Returns the offset of the first byte b in p[0..len) which satisfies
+ * (b & mask) == value, or len if there is none.
+ * Whole words are tested at once with the "has zero byte" trick.
+ */
+static inline u32 ts_sync_search(const u8 *p, u32 len, u8 mask, u8 value)
+{
+	const unsigned long ones = TS_SYNC_REPEAT_BYTE(0x01);
+	const unsigned long highs = TS_SYNC_REPEAT_BYTE(0x80);
+	const unsigned long m = TS_SYNC_REPEAT_BYTE(mask);
+	const unsigned long v = TS_SYNC_REPEAT_BYTE(value);
+	u32 i = 0;
+
+	while (i < len && ((uintptr_t)(p + i) & (sizeof(unsigned long) - 1))) {
+		if ((p[i] & mask) == value)
+			return i;
+
+		i++;
+	}
+
+	while (i + sizeof(unsigned long) <= len) {
+		unsigned long x = (*(const unsigned long *)(p + i) & m) ^ v;
+
+		if ((x - ones) & ~x & highs)
+			break;
+
+		i += sizeof(unsigned long);
+	}
+
+	while (i < len) {
+		if ((p[i] & mask) == value)
+			return i;
+
+		i++;
+	}
+
+	return len;
+}
+
+/*
+ * Skips to the next sync byte candidate after p[0] when the stream has lost
+ * synchronization.
+ */
+static inline void ts_sync_skip(u8 **p, u32 *remain, u8 mask, u8 value)
+{
+	u32 skip = 1;
+
+	if (likely(*remain > 1))
+		skip += ts_sync_search(*p + 1, *remain - 1, mask, value);
+
+	*p += skip;
+	*remain -= skip;
+}
+
+#endif
@@ -33,6 +33,140 @@ struct ptx_freq {
 #define PTX_DISABLE_LNB_POWER	_IO(0x8d, 0x06)
 #define PTX_SET_SYSTEM_MODE	_IOW(0x8d, 0x0b, int)
 
+// mmap interface
+//
+// mmap(2) of a tsdev maps one control page at offset 0, followed by the ring
+// data area (ptx_mmap_ctrl.size bytes, a multiple of the page size).
+// (written - consumed) bytes starting at data + head (wrapping at size) are
+// ready to be consumed. Pass the number of bytes processed to
+// PTX_MMAP_CONSUME to release them. The mapping is read-only.
+
+struct ptx_mmap_ctrl {
+	__u32 size;				// size of the data area in bytes
+	__u32 head;				// read offset in the data area
+	__u32 tail;				// write offset in the data area
+	__u32 written;				// total bytes written (wraps)
+	__u32 consumed;				// total bytes consumed (wraps)
+};
+
+#define PTX_MMAP_CONSUME	_IOW(0x8d, 0x10, __u32)
+
+// shared read
+//
+// While the owner (the first opener) has enabled PTX_SET_SHARED_READ, the
+// tsdev can be opened any number of times with O_RDONLY. These read-only
+// openers share the owner's stream: each one reads through its own cursor
+// and never slows down the owner or the other readers. A reader that falls
+// too far behind skips the overwritten data and accounts it in lost_bytes.
+// The stream is delivered to the readers even if the owner never reads, and
+// while any reader is attached the owner's oldest unread data is dropped on
+// overflow (PTX_OVERFLOW_DROP_OLDEST), so that the owner does not hold the
+// readers back either. Readers see end of file once the owner closes the
+// tsdev.
+
+struct ptx_reader_stats {
+	__u64 read_bytes;
+	__u64 lost_bytes;
+};
+
+#define PTX_SET_SHARED_READ	_IOW(0x8d, 0x11, int)
+#define PTX_GET_READER_STATS	_IOR(0x8d, 0x12, struct ptx_reader_stats)
+
+// software pid filter
+//
+// Bit (pid % 8) of map[pid / 8] selects whether packets of that pid are
+// delivered. The filter applies to the owner's stream, so readers sharing
+// the tsdev see the filtered stream as well.
+
+struct ptx_pid_filter {
+	__u8 map[8192 / 8];
+};
+
+#define PTX_SET_PID_FILTER	_IOW(0x8d, 0x13, struct ptx_pid_filter)
+#define PTX_CLEAR_PID_FILTER	_IO(0x8d, 0x14)
+
+// hardware pid filter
+//
+// Programs the pid table of the bridge for the input port of the tsdev, so
+// that unwanted packets are dropped before they are transferred over USB.
+// Up to 64 pids can be passed or blocked. PTX_HW_PID_FILTER_DEFAULT restores
+// the filter set up by the driver (see the discard_null_packets parameter),
+// which is also done when the tsdev is closed.
+
+enum ptx_hw_pid_filter_mode {
+	PTX_HW_PID_FILTER_DEFAULT = 0,
+	PTX_HW_PID_FILTER_PASS,
+	PTX_HW_PID_FILTER_BLOCK
+};
+
+struct ptx_hw_pid_filter {
+	int mode;				// enum ptx_hw_pid_filter_mode
+	int num;
+	__u16 pid[64];
+};
+
+#define PTX_SET_HW_PID_FILTER	_IOW(0x8d, 0x15, struct ptx_hw_pid_filter)
+
+// service filter
+//
+// Passes only the packets of the service with the given service_id, plus the
+// common PSI/SI pids. The driver follows the PAT and the PMT of the service
+// and updates the software pid filter, and the hardware pid filter where
+// available, as they change. Pass 0 to stop following. Setting or clearing
+// the software pid filter also stops following.
+
+#define PTX_SET_SERVICE_FILTER	_IOW(0x8d, 0x16, int)
+
+// overflow policy
+//
+// Selects what is dropped when the owner does not read fast enough. Data is
+// always dropped in whole packets. PTX_OVERFLOW_DROP_NEWEST (the default)
+// discards incoming packets, PTX_OVERFLOW_DROP_OLDEST discards the oldest
+// unread packets to keep the latency bounded. With mmap, the oldest packets
+// may then be overwritten while the application is still processing them.
+// While read-only readers are attached, PTX_OVERFLOW_DROP_OLDEST is used
+// whatever has been selected. PTX_GET_DROP_STATS returns the amount dropped
+// since streaming was started.
+
+enum ptx_overflow_policy {
+	PTX_OVERFLOW_DROP_NEWEST = 0,
+	PTX_OVERFLOW_DROP_OLDEST
+};
+
+struct ptx_drop_stats {
+	__u64 packets;
+	__u64 bytes;
+};
+
+#define PTX_SET_OVERFLOW_POLICY	_IOW(0x8d, 0x17, int)
+#define PTX_GET_DROP_STATS	_IOR(0x8d, 0x18, struct ptx_drop_stats)
+
+// wakeup parameters
+//
+// Per file descriptor. read(2) and poll(2) wait until low_watermark bytes are
+// available (at most half of the ring buffer), unless some data has been
+// waiting for longer than max_latency_us. Pass 0 to restore the default,
+// which is to wake up every tenth of the ring buffer without a time limit.
+
+struct ptx_wakeup_params {
+	__u32 low_watermark;			// in bytes
+	__u32 max_latency_us;
+};
+
+#define PTX_SET_WAKEUP_PARAMS	_IOW(0x8d, 0x19, struct ptx_wakeup_params)
+
+// M2TS mode
+//
+// Per file descriptor. While enabled, read(2) returns 192 bytes packets: each
+// TS packet is preceded by a 4 bytes BDAV/M2TS header which holds the arrival
+// time of the packet in its lower 30 bits, in 27 MHz units. The arrival time
+// is taken when the driver processes the transfer carrying the packet.
+// Reads return whole packets only and need a buffer of at least 192 bytes.
+// Packets received before the mode was first enabled on the tsdev carry no
+// meaningful time.
+
+#define PTX_SET_M2TS_MODE	_IOW(0x8d, 0x1a, int)
+
 // extended ioctls
 
 struct ptxt_cap {
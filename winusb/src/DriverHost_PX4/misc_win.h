@@ -17,9 +17,13 @@ typedef int32_t s32;
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 #define ARRAY_SIZE(arr)	(sizeof(arr) / sizeof((arr)[0]))
 
+#define likely(x)	(x)
+#define unlikely(x)	(x)
+
 #define msleep(ms)		Sleep((ms) + (16 - ((ms) % 16)))
 #define mdelay(ms)		/* do nothing*/
 
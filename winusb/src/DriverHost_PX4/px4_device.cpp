@@ -408,7 +408,7 @@ int Px4Device::StartCapture()
 		it930x_.bus.usb.streaming.no_dma = true;
 		it930x_.bus.usb.streaming.no_raw_io = config_.usb.no_raw_io;
 
-		stream_ctx_.remain_len = 0;
+		ts_demux_init(&stream_ctx_.demux, TS_DEMUX_FORMAT_TAGGED, 4, StreamPut, &stream_ctx_);
 
 		ret = itedtv_bus_start_streaming(&it930x_.bus, StreamHandler, this);
 		if (ret) {
@@ -442,94 +442,23 @@ int Px4Device::StopCapture()
 	return 0;
 }
 
-void Px4Device::StreamProcess(std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[], std::uint8_t **buf, std::size_t &len)
+void Px4Device::StreamPut(void *context, int id, std::uint8_t *buf, std::uint32_t len)
 {
-	std::uint8_t *p = *buf;
-	std::size_t remain = len;
-
-	while (remain) {
-		std::size_t i;
-		bool sync_remain = false;
-
-		for (i = 0; i < PX4_DEVICE_TS_SYNC_COUNT; i++) {
-			if (((i + 1) * 188) <= remain) {
-				if ((p[i * 188] & 0x8f) != 0x07)
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-		}
-
-		if (sync_remain)
-			break;
-
-		if (i < PX4_DEVICE_TS_SYNC_COUNT) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		while (remain >= 188 && ((p[0] & 0x8f) == 0x07)) {
-			u8 id = (p[0] & 0x70) >> 4;
-
-			if (id && id < 5) {
-				std::size_t pkt_len = 188;
-
-				p[0] = 0x47;
-				stream_buf[id - 1]->Write(p, pkt_len);
-			}
-
-			p += 188;
-			remain -= 188;
-		}
-	}
+	StreamContext &stream_ctx = *static_cast<StreamContext*>(context);
+	std::size_t size = len;
 
-	for (int i = 0; i < 4; i++)
-		stream_buf[i]->NotifyWrite();
-
-	*buf = p;
-	len = remain;
-
-	return;
+	stream_ctx.stream_buf[id]->Write(buf, size);
 }
 
 int Px4Device::StreamHandler(void *context, void *buf, std::uint32_t len)
 {
 	Px4Device &obj = *static_cast<Px4Device*>(context);
 	StreamContext &stream_ctx = obj.stream_ctx_;
-	std::uint8_t *p = static_cast<std::uint8_t*>(buf);
-	std::size_t remain = len;
-
-	if (stream_ctx.remain_len) {
-		if ((stream_ctx.remain_len + len) >= PX4_DEVICE_TS_SYNC_SIZE) {
-			std::uint8_t * remain_buf = stream_ctx.remain_buf;
-			std::size_t t = PX4_DEVICE_TS_SYNC_SIZE - stream_ctx.remain_len;
-
-			memcpy(remain_buf + stream_ctx.remain_len, p, t);
-			stream_ctx.remain_len = PX4_DEVICE_TS_SYNC_SIZE;
-
-			StreamProcess(stream_ctx.stream_buf, &remain_buf, stream_ctx.remain_len);
-			if (!stream_ctx.remain_len) {
-				p += t;
-				remain -= t;
-			}
 
-			stream_ctx.remain_len = 0;
-		} else {
-			memcpy(stream_ctx.remain_buf + stream_ctx.remain_len, p, len);
-			stream_ctx.remain_len += len;
+	ts_demux_process(&stream_ctx.demux, buf, len);
 
-			return 0;
-		}
-	}
-
-	StreamProcess(stream_ctx.stream_buf, &p, remain);
-
-	if (remain) {
-		memcpy(stream_ctx.remain_buf, p, remain);
-		stream_ctx.remain_len = remain;
-	}
+	for (int i = 0; i < 4; i++)
+		stream_ctx.stream_buf[i]->NotifyWrite();
 
 	return 0;
 }
@@ -20,15 +20,13 @@
 #include "i2c_comm.h"
 #include "it930x.h"
 #include "itedtv_bus.h"
+#include "ts_demux.h"
 #include "tc90522.h"
 #include "r850.h"
 #include "rt710.h"
 
 namespace px4 {
 
-#define PX4_DEVICE_TS_SYNC_COUNT	4U
-#define PX4_DEVICE_TS_SYNC_SIZE		(188U * PX4_DEVICE_TS_SYNC_COUNT)
-
 enum class Px4MultiDeviceMode {
 	ALL = 0,
 	S_ONLY,
@@ -83,8 +81,7 @@ private:
 	};
 	struct StreamContext final {
 		std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[4];
-		std::uint8_t remain_buf[PX4_DEVICE_TS_SYNC_SIZE];
-		std::size_t remain_len;
+		struct ts_demux demux;
 	};
 
 	class MultiDevice final {
@@ -189,7 +186,7 @@ private:
 	int StartCapture();
 	int StopCapture();
 
-	static void StreamProcess(std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[], std::uint8_t **buf, std::size_t &len);
+	static void StreamPut(void *context, int id, std::uint8_t *buf, std::uint32_t len);
 	static int StreamHandler(void *context, void *buf, std::uint32_t len);
 
 	Px4DeviceConfig config_;
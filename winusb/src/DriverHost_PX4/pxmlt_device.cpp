@@ -375,7 +375,7 @@ int PxMltDevice::StartCapture()
 		it930x_.bus.usb.streaming.no_dma = true;
 		it930x_.bus.usb.streaming.no_raw_io = config_.usb.no_raw_io;
 
-		stream_ctx_.remain_len = 0;
+		ts_demux_init(&stream_ctx_.demux, TS_DEMUX_FORMAT_TAGGED, receiver_num_, StreamPut, &stream_ctx_);
 
 		ret = itedtv_bus_start_streaming(&it930x_.bus, StreamHandler, this);
 		if (ret) {
@@ -409,96 +409,23 @@ int PxMltDevice::StopCapture()
 	return 0;
 }
 
-void PxMltDevice::StreamProcess(std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[], int num, std::uint8_t **buf, std::size_t &len)
+void PxMltDevice::StreamPut(void *context, int id, std::uint8_t *buf, std::uint32_t len)
 {
-	std::uint8_t *p = *buf;
-	std::size_t remain = len;
+	StreamContext &stream_ctx = *static_cast<StreamContext*>(context);
+	std::size_t size = len;
 
-	while (remain) {
-		std::size_t i;
-		bool sync_remain = false;
-
-		for (i = 0; i < PXMLT_DEVICE_TS_SYNC_COUNT; i++) {
-			if (((i + 1) * 188) <= remain) {
-				if ((p[i * 188] & 0x8f) != 0x07)
-					break;
-			} else {
-				sync_remain = true;
-				break;
-			}
-		}
-
-		if (sync_remain)
-			break;
-
-		if (i < PXMLT_DEVICE_TS_SYNC_COUNT) {
-			p++;
-			remain--;
-			continue;
-		}
-
-		while (remain >= 188 && ((p[0] & 0x8f) == 0x07)) {
-			u8 id = (p[0] & 0x70) >> 4;
-
-			if (id && id <= num) {
-				std::size_t pkt_len = 188;
-
-				p[0] = 0x47;
-				stream_buf[id - 1]->Write(p, pkt_len);
-			}
-
-			p += 188;
-			remain -= 188;
-		}
-	}
-
-	for (int i = 0; i < num; i++)
-		stream_buf[i]->NotifyWrite();
-
-	*buf = p;
-	len = remain;
-
-	return;
+	stream_ctx.stream_buf[id]->Write(buf, size);
 }
 
 int PxMltDevice::StreamHandler(void *context, void *buf, std::uint32_t len)
 {
 	PxMltDevice &obj = *static_cast<PxMltDevice*>(context);
-	int receiver_num = obj.receiver_num_;
 	StreamContext &stream_ctx = obj.stream_ctx_;
-	std::uint8_t *p = static_cast<std::uint8_t*>(buf);
-	std::size_t remain = len;
-
-	if (stream_ctx.remain_len) {
-		if ((stream_ctx.remain_len + len) >= PXMLT_DEVICE_TS_SYNC_SIZE) {
-			std::uint8_t * remain_buf = stream_ctx.remain_buf;
-			std::size_t t = PXMLT_DEVICE_TS_SYNC_SIZE - stream_ctx.remain_len;
-
-			memcpy(remain_buf + stream_ctx.remain_len, p, t);
-			stream_ctx.remain_len = PXMLT_DEVICE_TS_SYNC_SIZE;
-
-			StreamProcess(stream_ctx.stream_buf, receiver_num, &remain_buf, stream_ctx.remain_len);
-			if (!stream_ctx.remain_len) {
-				p += t;
-				remain -= t;
-			}
-
-			stream_ctx.remain_len = 0;
-		} else {
-			memcpy(stream_ctx.remain_buf + stream_ctx.remain_len, p, len);
-			stream_ctx.remain_len += len;
-
-			return 0;
-		}
-	}
 
-	StreamProcess(stream_ctx.stream_buf, receiver_num, &p, remain);
+	ts_demux_process(&stream_ctx.demux, buf, len);
 
-	if (remain) {
-		dev_dbg(&obj.dev_, "px4::PxMltDevice::StreamHandler: remain: %lu\n", remain);
-		memcpy(stream_ctx.remain_buf, p, remain);
-		stream_ctx.remain_len = remain;
-	}
+	for (int i = 0; i < obj.receiver_num_; i++)
+		stream_ctx.stream_buf[i]->NotifyWrite();
 
 	return 0;
 }
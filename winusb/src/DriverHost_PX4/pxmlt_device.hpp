@@ -20,14 +20,12 @@
 #include "i2c_comm.h"
 #include "it930x.h"
 #include "itedtv_bus.h"
+#include "ts_demux.h"
 #include "cxd2856er.h"
 #include "cxd2858er.h"
 
 namespace px4 {
 
-#define PXMLT_DEVICE_TS_SYNC_COUNT	4
-#define PXMLT_DEVICE_TS_SYNC_SIZE	(188 * PXMLT_DEVICE_TS_SYNC_COUNT)
-
 enum class PxMltDeviceModel {
 	PXMLT5U = 0,
 	PXMLT5PE,
@@ -76,8 +74,7 @@ public:
 private:
 	struct StreamContext final {
 		std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[5];
-		std::uint8_t remain_buf[PXMLT_DEVICE_TS_SYNC_SIZE];
-		std::size_t remain_len;
+		struct ts_demux demux;
 	};
 
 	class PxMltReceiver final : public px4::ReceiverBase {
@@ -135,7 +132,7 @@ private:
 	int StartCapture();
 	int StopCapture();
 
-	static void StreamProcess(std::shared_ptr<px4::ReceiverBase::StreamBuffer> stream_buf[], int num, std::uint8_t **buf, std::size_t &len);
+	static void StreamPut(void *context, int id, std::uint8_t *buf, std::uint32_t len);
 	static int StreamHandler(void *context, void *buf, std::uint32_t len);
 
 	static const struct PxMltDeviceParam final {